@@ -0,0 +1,688 @@
+/***************************************************************************************************
+ Copyright (C) 2024 The Qt Company Ltd.
+ SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only WITH Qt-GPL-exception-1.0
+***************************************************************************************************/
+
+/*
+ * Benchmark of the qmake reader on a generated project tree.
+ *
+ * The tree is a subdirs project with one sub-project per subdir. Every sub-project includes a
+ * chain of .pri files, lists a number of sources, derives its headers through custom replace
+ * functions, tests CONFIG in the usual ways and collects files with files() globs.
+ *
+ * Each iteration times the phases separately:
+ *   parse     parsing all files into a cold ProFileCache
+ *   evaluate  evaluating all sub-projects on the warm cache
+ *   eval-tok  the same with the lowered token streams turned off, so that every block is
+ *             interpreted from the tokens
+ *   tree      QMakeDataProvider::readTree() on the root project, from scratch
+ *   write     writing the results of the tree as xml and binary, like qmakefilereader does
+ *
+ * The scan phases only run the tokenizer, on contents read into memory beforehand, once with
+ * the vectorized scanning of QMakeParser and once with the plain per-character loops. Pass the
+ * mkspecs directory of a Qt installation to measure them on its .conf, .pri and .prf files; by
+ * default the generated tree is used.
+ *
+ * The list phases evaluate small projects which apply -=, *= and unique() to lists of a given
+ * size (10000 by default). The list-base phase only assigns the lists, for reference.
+ *
+ * The value map phases replay the variable assignments and references found in a set of files
+ * against ProValueMap and, for comparison, a plain QHash. Pass the mkspecs/features directory of
+ * a Qt installation to measure them on real feature files; by default the generated tree is used.
+ *
+ * Build with qmake benchmark.pro && make, run qmakereaderbench --help for the parameters.
+ */
+
+#include "evalhandler.h"
+#include "qmakedataprovider.h"
+#include "resultwriter.h"
+#include <qmakeevaluator.h>
+#include <qmakeglobals.h>
+#include <qmakeparser.h>
+#include <proitems.h>
+#include <QtCore/QBuffer>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QRegExp>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QStringList>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QTextStream>
+#include <QtCore/QVector>
+
+#include <algorithm>
+
+#if defined(Q_OS_WIN)
+#  include <windows.h>
+#  include <psapi.h>
+#elif defined(Q_OS_UNIX)
+#  include <sys/resource.h>
+#endif
+
+namespace {
+
+struct Parameters
+{
+    Parameters()
+        : subdirs(20), depth(10), sources(200), configs(100), globs(5), functions(10),
+          iterations(5), listSize(10000)
+    {}
+
+    int subdirs;
+    int depth;
+    int sources;
+    int configs;
+    int globs;
+    int functions;
+    int iterations;
+    int listSize;
+    QString keepDir;
+    QString featuresDir;
+    QString mkspecsDir;
+};
+
+struct GeneratedTree
+{
+    GeneratedTree() : lines(0), evaluatedFiles(0), evaluatedLines(0) {}
+
+    QString rootProject;
+    QStringList projects;
+    QStringList files;
+    qint64 lines;
+    qint64 evaluatedFiles;
+    qint64 evaluatedLines;
+};
+
+class TreeGenerator
+{
+public:
+    TreeGenerator(const Parameters &params, const QString &dir) : m_params(params), m_dir(dir) {}
+
+    GeneratedTree generate()
+    {
+        QDir().mkpath(m_dir + QLatin1String("/common"));
+
+        QString functions;
+        for (int i = 0; i < m_params.functions; ++i) {
+            functions += QString::fromLatin1(
+                        "defineReplace(bench_headers_%1) {\n"
+                        "    result =\n"
+                        "    for (file, 1): result += $$replace(file, \\\\.cpp$, .h)\n"
+                        "    return($$result)\n"
+                        "}\n\n").arg(i);
+        }
+        const int functionLines = writeFile(QLatin1String("common/functions.pri"), functions);
+
+        int chainLines = 0;
+        for (int i = 0; i < m_params.depth; ++i) {
+            QString chain = QString::fromLatin1(
+                        "CHAIN_LEVEL = %1\n"
+                        "CHAIN_DEFINES += LEVEL_%1\n"
+                        "CONFIG += feature_%1\n").arg(i);
+            if (i + 1 < m_params.depth)
+                chain += QString::fromLatin1("include(chain%1.pri)\n").arg(i + 1);
+            chainLines += writeFile(QString::fromLatin1("common/chain%1.pri").arg(i), chain);
+        }
+
+        QString root = QLatin1String("TEMPLATE = subdirs\nSUBDIRS += \\\n");
+        for (int p = 0; p < m_params.subdirs; ++p) {
+            const QString name = QString::fromLatin1("project%1").arg(p);
+            root += QString::fromLatin1("    %1 \\\n").arg(name);
+            const int lines = writeProject(p, name);
+            m_tree.projects << m_dir + QLatin1Char('/') + name + QLatin1Char('/') + name
+                               + QLatin1String(".pro");
+            m_tree.evaluatedFiles += 2 + m_params.depth;
+            m_tree.evaluatedLines += lines + functionLines + chainLines;
+        }
+        root += QLatin1Char('\n');
+        writeFile(QLatin1String("root.pro"), root);
+        m_tree.rootProject = m_dir + QLatin1String("/root.pro");
+        return m_tree;
+    }
+
+private:
+    int writeProject(int index, const QString &name)
+    {
+        const QString dir = name + QLatin1Char('/');
+        QDir().mkpath(m_dir + QLatin1Char('/') + dir + QLatin1String("src"));
+
+        QString pro = QString::fromLatin1(
+                    "TEMPLATE = app\n"
+                    "TARGET = %1\n"
+                    "include(../common/functions.pri)\n"
+                    "include(../common/chain0.pri)\n\n"
+                    "SOURCES += \\\n").arg(name);
+        for (int i = 0; i < m_params.sources; ++i)
+            pro += QString::fromLatin1("    src/file_%1.cpp \\\n").arg(i);
+        pro += QLatin1Char('\n');
+
+        if (m_params.functions > 0) {
+            pro += QString::fromLatin1("HEADERS += $$bench_headers_%1($$SOURCES)\n\n")
+                    .arg(index % m_params.functions);
+        }
+
+        // Half of the tested features are set by the include chain.
+        const int features = qMax(1, 2 * m_params.depth);
+        for (int i = 0; i < m_params.configs; ++i) {
+            const int feature = i % features;
+            if (i % 2) {
+                pro += QString::fromLatin1("feature_%1: DEFINES += HAVE_FEATURE_%2\n")
+                        .arg(feature).arg(i);
+            } else {
+                pro += QString::fromLatin1(
+                            "CONFIG(feature_%1, feature_%1|feature_none): DEFINES += PICKED_%2\n")
+                        .arg(feature).arg(i);
+            }
+        }
+        pro += QLatin1Char('\n');
+
+        for (int i = 0; i < m_params.globs; ++i) {
+            pro += QString::fromLatin1("OTHER_FILES += $$files(src/*.g%1)\n").arg(i);
+            writeFile(dir + QString::fromLatin1("src/glob_%1.g%1").arg(i), QString());
+        }
+        pro += QLatin1String("FORMS += $$files(src/*.ui)\n");
+        writeFile(dir + QLatin1String("src/form.ui"), QString());
+
+        return writeFile(dir + name + QLatin1String(".pro"), pro);
+    }
+
+    int writeFile(const QString &relativePath, const QString &contents)
+    {
+        const QString fileName = m_dir + QLatin1Char('/') + relativePath;
+        QFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning("qmakereaderbench: cannot write %s", qPrintable(fileName));
+            return 0;
+        }
+        file.write(contents.toUtf8());
+        const int lines = contents.count(QLatin1Char('\n'));
+        if (relativePath.endsWith(QLatin1String(".pro"))
+                || relativePath.endsWith(QLatin1String(".pri"))) {
+            m_tree.files << fileName;
+            m_tree.lines += lines;
+        }
+        return lines;
+    }
+
+    const Parameters &m_params;
+    const QString m_dir;
+    GeneratedTree m_tree;
+};
+
+// Projects operating on large lists, in the order base, remove, insert and unique.
+QStringList generateListProjects(const QString &dir, int size)
+{
+    QString files = QLatin1String("LIST_FILES = \\\n");
+    QString excluded = QLatin1String("LIST_EXCLUDED = \\\n");
+    for (int i = 0; i < size; ++i) {
+        const QString line = QString::fromLatin1("    src/list_%1.cpp \\\n").arg(i);
+        files += line;
+        if (!(i % 2))
+            excluded += line;
+    }
+    const QString lists = files + QLatin1Char('\n') + excluded + QLatin1Char('\n')
+            + QLatin1String("LIST_DUPLICATES = $$LIST_FILES $$LIST_EXCLUDED $$LIST_FILES\n");
+
+    const char * const operations[] = {
+        "",
+        "LIST_FILES -= $$LIST_EXCLUDED\n",
+        "LIST_MORE = $$LIST_EXCLUDED\nLIST_MORE *= $$LIST_FILES\n",
+        "LIST_UNIQUE = $$unique(LIST_DUPLICATES)\n"
+    };
+    const char * const names[] = { "base", "remove", "insert", "unique" };
+
+    QDir().mkpath(dir + QLatin1String("/lists"));
+    QStringList projects;
+    for (int i = 0; i < 4; ++i) {
+        const QString fileName = dir + QLatin1String("/lists/") + QLatin1String(names[i])
+                + QLatin1String(".pro");
+        QFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning("qmakereaderbench: cannot write %s", qPrintable(fileName));
+            continue;
+        }
+        file.write((lists + QLatin1String(operations[i])).toUtf8());
+        projects << fileName;
+    }
+    return projects;
+}
+
+qint64 peakResidentSetSize()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+#  ifdef Q_OS_MAC
+    return usage.ru_maxrss;
+#  else
+    return qint64(usage.ru_maxrss) * 1024;
+#  endif
+#else
+    return 0;
+#endif
+}
+
+class Phase
+{
+public:
+    // Pass lines < 0 for phases which only count operations.
+    Phase(const QString &name, qint64 files, qint64 lines)
+        : m_name(name), m_files(files), m_lines(lines) {}
+
+    void add(qint64 nsecs) { m_times << nsecs; }
+
+    void report(QTextStream &out) const
+    {
+        QVector<qint64> times = m_times;
+        std::sort(times.begin(), times.end());
+        const qint64 median = times.at(times.size() / 2);
+        const double seconds = qMax<qint64>(median, 1) / 1e9;
+        out << qSetFieldWidth(10) << m_name << qSetFieldWidth(0) << ' '
+            << qSetFieldWidth(11) << QString::number(median / 1e6, 'f', 2) << ' '
+            << qSetFieldWidth(11) << QString::number(times.first() / 1e6, 'f', 2) << ' '
+            << qSetFieldWidth(11) << QString::number(m_files / seconds, 'f', 0);
+        if (m_lines >= 0) {
+            out << qSetFieldWidth(0) << ' ' << qSetFieldWidth(11)
+                << (m_lines ? QString::number(m_lines / seconds, 'f', 0) : QStringLiteral("-"));
+        }
+        out << qSetFieldWidth(0) << '\n';
+    }
+
+private:
+    QString m_name;
+    qint64 m_files;
+    qint64 m_lines;
+    QVector<qint64> m_times;
+};
+
+qint64 timeParse(const GeneratedTree &tree, ProFileCache *cache)
+{
+    EvalHandler handler;
+    QMakeParser parser(cache, &handler);
+    QElapsedTimer timer;
+    timer.start();
+    foreach (const QString &fileName, tree.files) {
+        if (ProFile *pro = parser.parsedProFile(fileName, true))
+            pro->deref();
+    }
+    return timer.nsecsElapsed();
+}
+
+qint64 timeEvaluate(const GeneratedTree &tree, ProFileCache *cache, bool bytecode = true)
+{
+    QMakeEvaluator::setBytecodeEnabled(bytecode);
+    QMakeGlobals globals;
+    EvalHandler handler;
+    QMakeParser parser(cache, &handler);
+    QElapsedTimer timer;
+    timer.start();
+    foreach (const QString &fileName, tree.projects) {
+        QMakeEvaluator evaluator(&globals, &parser, &handler);
+        if (evaluator.evaluateFile(fileName, QMakeHandler::EvalProjectFile,
+                                   QMakeEvaluator::LoadProOnly) != QMakeEvaluator::ReturnTrue) {
+            qWarning("qmakereaderbench: failed to evaluate %s", qPrintable(fileName));
+        }
+        handler.takeDependencies();
+    }
+    const qint64 nsecs = timer.nsecsElapsed();
+    QMakeEvaluator::setBytecodeEnabled(true);
+    return nsecs;
+}
+
+struct ScanWorkload
+{
+    ScanWorkload() : lines(0), bytes(0) {}
+
+    QStringList names;
+    QStringList contents;
+    qint64 lines;
+    qint64 bytes;
+};
+
+ScanWorkload collectScanWorkload(const QStringList &files)
+{
+    ScanWorkload workload;
+    foreach (const QString &fileName, files) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        const QString contents = QString::fromLocal8Bit(file.readAll());
+        workload.names << fileName;
+        workload.contents << contents;
+        workload.lines += contents.count(QLatin1Char('\n'));
+        workload.bytes += contents.size();
+    }
+    return workload;
+}
+
+qint64 timeScan(const ScanWorkload &workload, bool vector)
+{
+    QMakeParser::setVectorScanning(vector);
+    EvalHandler handler;
+    QMakeParser parser(0, &handler);
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < workload.contents.size(); ++i) {
+        if (ProFile *pro = parser.parsedProBlock(workload.contents.at(i), workload.names.at(i), 1))
+            pro->deref();
+    }
+    const qint64 nsecs = timer.nsecsElapsed();
+    QMakeParser::setVectorScanning(true);
+    return nsecs;
+}
+
+qint64 timeEvaluateList(const QString &fileName, ProFileCache *cache)
+{
+    QMakeGlobals globals;
+    EvalHandler handler;
+    QMakeParser parser(cache, &handler);
+    QMakeEvaluator evaluator(&globals, &parser, &handler);
+    QElapsedTimer timer;
+    timer.start();
+    if (evaluator.evaluateFile(fileName, QMakeHandler::EvalProjectFile,
+                               QMakeEvaluator::LoadProOnly) != QMakeEvaluator::ReturnTrue) {
+        qWarning("qmakereaderbench: failed to evaluate %s", qPrintable(fileName));
+    }
+    const qint64 nsecs = timer.nsecsElapsed();
+    handler.takeDependencies();
+    return nsecs;
+}
+
+qint64 timeWrite(const QList<QMakeProjectData> &results, ResultWriter::Format format)
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    QElapsedTimer timer;
+    timer.start();
+    QScopedPointer<ResultWriter> writer(ResultWriter::create(format, &buffer));
+    writer->begin(true);
+    foreach (const QMakeProjectData &data, results)
+        writer->write(data);
+    writer->end();
+    return timer.nsecsElapsed();
+}
+
+// Variable names in the order a straight evaluation of the files would touch them.
+struct ValueMapWorkload
+{
+    QVector<ProKey> assignments;
+    QVector<ProKey> references;
+};
+
+enum { LookupRounds = 20 };
+
+ValueMapWorkload collectValueMapWorkload(const QStringList &files)
+{
+    QRegExp assignment(QLatin1String("^\\s*([A-Za-z_][A-Za-z0-9_.]*)\\s*[-+*~]?="));
+    QRegExp reference(QLatin1String("\\$\\$\\{?([A-Za-z_][A-Za-z0-9_.]*)(\\(?)"));
+    ValueMapWorkload workload;
+    foreach (const QString &fileName, files) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        foreach (const QString &line, QString::fromUtf8(file.readAll()).split(QLatin1Char('\n'))) {
+            if (assignment.indexIn(line) >= 0) {
+                ProKey key(assignment.cap(1));
+                key.intern(); // Like the names in a token stream
+                workload.assignments << key;
+            }
+            for (int pos = 0; (pos = reference.indexIn(line, pos)) >= 0;
+                 pos += reference.matchedLength()) {
+                if (!reference.cap(2).isEmpty())
+                    continue; // Function call
+                ProKey key(reference.cap(1));
+                key.intern();
+                workload.references << key;
+            }
+        }
+    }
+    return workload;
+}
+
+template <typename Map>
+qint64 timeMapInsert(const ValueMapWorkload &workload, Map *map)
+{
+    const ProString value("value");
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < workload.assignments.size(); ++i)
+        (*map)[workload.assignments.at(i)] << value;
+    return timer.nsecsElapsed();
+}
+
+template <typename Map>
+qint64 timeMapLookup(const ValueMapWorkload &workload, const Map &map, int *hits)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for (int r = 0; r < LookupRounds; ++r) {
+        for (int i = 0; i < workload.references.size(); ++i) {
+            if (map.constFind(workload.references.at(i)) != map.constEnd())
+                ++*hits;
+        }
+    }
+    return timer.nsecsElapsed();
+}
+
+bool parseArguments(const QStringList &args, Parameters *params)
+{
+    foreach (const QString &arg, args) {
+        const int eq = arg.indexOf(QLatin1Char('='));
+        const QString option = arg.left(eq);
+        const QString value = eq < 0 ? QString() : arg.mid(eq + 1);
+        bool ok = true;
+        if (option == QLatin1String("--subdirs"))
+            params->subdirs = value.toInt(&ok);
+        else if (option == QLatin1String("--depth"))
+            params->depth = value.toInt(&ok);
+        else if (option == QLatin1String("--sources"))
+            params->sources = value.toInt(&ok);
+        else if (option == QLatin1String("--configs"))
+            params->configs = value.toInt(&ok);
+        else if (option == QLatin1String("--globs"))
+            params->globs = value.toInt(&ok);
+        else if (option == QLatin1String("--functions"))
+            params->functions = value.toInt(&ok);
+        else if (option == QLatin1String("--iterations"))
+            params->iterations = value.toInt(&ok);
+        else if (option == QLatin1String("--list-size"))
+            params->listSize = value.toInt(&ok);
+        else if (option == QLatin1String("--keep"))
+            params->keepDir = QDir(value).absolutePath();
+        else if (option == QLatin1String("--features"))
+            params->featuresDir = QDir(value).absolutePath();
+        else if (option == QLatin1String("--mkspecs"))
+            params->mkspecsDir = QDir(value).absolutePath();
+        else
+            ok = false;
+        if (!ok || eq < 0)
+            return false;
+    }
+    return params->subdirs > 0 && params->depth > 0 && params->iterations > 0
+            && params->listSize > 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    args.removeFirst();
+
+    Parameters params;
+    if (!parseArguments(args, &params)) {
+        fputs("Usage: qmakereaderbench [options]\n"
+              "Options:\n"
+              "  --subdirs=<n>      Number of sub-projects (20)\n"
+              "  --depth=<n>        Length of the include chain of every sub-project (10)\n"
+              "  --sources=<n>      Number of SOURCES per sub-project (200)\n"
+              "  --configs=<n>      Number of CONFIG tests per sub-project (100)\n"
+              "  --globs=<n>        Number of files() globs per sub-project (5)\n"
+              "  --functions=<n>    Number of custom replace functions (10)\n"
+              "  --iterations=<n>   Number of measurements per phase (5)\n"
+              "  --list-size=<n>    Number of values in the lists of the list phases (10000)\n"
+              "  --keep=<dir>       Generate the tree in dir and keep it\n"
+              "  --features=<dir>   Take the value map workload from the .prf files in dir\n"
+              "  --mkspecs=<dir>    Take the scan workload from the qmake files in dir\n",
+              stderr);
+        return -1;
+    }
+
+    QTemporaryDir tempDir;
+    const QString dir = params.keepDir.isEmpty() ? tempDir.path() : params.keepDir;
+    const GeneratedTree tree = TreeGenerator(params, dir).generate();
+
+    QMakeEvaluator::initStatics();
+
+    Phase parse(QLatin1String("parse"), tree.files.size(), tree.lines);
+    Phase evaluate(QLatin1String("evaluate"), tree.evaluatedFiles, tree.evaluatedLines);
+    Phase evaluateTokens(QLatin1String("eval-tok"), tree.evaluatedFiles, tree.evaluatedLines);
+    QVector<qint64> evaluateTimes, evaluateTokensTimes;
+    Phase readTree(QLatin1String("tree"), tree.evaluatedFiles + 1, tree.evaluatedLines);
+    Phase writeXml(QLatin1String("write-xml"), tree.projects.size(), 0);
+    Phase writeBinary(QLatin1String("write-bin"), tree.projects.size(), 0);
+
+    QStringList workloadFiles;
+    if (params.featuresDir.isEmpty()) {
+        workloadFiles = tree.files;
+    } else {
+        QDirIterator it(params.featuresDir, QStringList(QLatin1String("*.prf")), QDir::Files,
+                        QDirIterator::Subdirectories);
+        while (it.hasNext())
+            workloadFiles << it.next();
+    }
+    QStringList scanFiles;
+    if (params.mkspecsDir.isEmpty()) {
+        scanFiles = tree.files;
+    } else {
+        QStringList filters;
+        filters << QLatin1String("*.conf") << QLatin1String("*.pri") << QLatin1String("*.prf")
+                << QLatin1String("*.pro");
+        QDirIterator it(params.mkspecsDir, filters, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext())
+            scanFiles << it.next();
+    }
+    const ScanWorkload scanWorkload = collectScanWorkload(scanFiles);
+    Phase scanVector(QLatin1String("scan-vec"), scanWorkload.names.size(), scanWorkload.lines);
+    Phase scanScalar(QLatin1String("scan-plain"), scanWorkload.names.size(), scanWorkload.lines);
+    QVector<qint64> scanVectorTimes, scanScalarTimes;
+
+    const QStringList listProjects = generateListProjects(dir, params.listSize);
+    QList<Phase> listPhases;
+    foreach (const QString &fileName, listProjects) {
+        listPhases << Phase(QLatin1String("list-") + QFileInfo(fileName).baseName(),
+                            params.listSize, -1);
+    }
+
+    const ValueMapWorkload workload = collectValueMapWorkload(workloadFiles);
+    const qint64 lookups = qint64(workload.references.size()) * LookupRounds;
+    Phase mapInsert(QLatin1String("map-insert"), workload.assignments.size(), -1);
+    Phase mapLookup(QLatin1String("map-lookup"), lookups, -1);
+    Phase hashInsert(QLatin1String("qhash-ins"), workload.assignments.size(), -1);
+    Phase hashLookup(QLatin1String("qhash-look"), lookups, -1);
+
+    for (int i = 0; i < params.iterations; ++i) {
+        ProFileCache cache;
+        parse.add(timeParse(tree, &cache));
+        const qint64 evaluateTime = timeEvaluate(tree, &cache);
+        const qint64 evaluateTokensTime = timeEvaluate(tree, &cache, false);
+        evaluate.add(evaluateTime);
+        evaluateTokens.add(evaluateTokensTime);
+        evaluateTimes << evaluateTime;
+        evaluateTokensTimes << evaluateTokensTime;
+
+        QMakeDataProvider dataProvider;
+        QElapsedTimer timer;
+        timer.start();
+        dataProvider.readTree(tree.rootProject);
+        readTree.add(timer.nsecsElapsed());
+        if (dataProvider.leafProjects().size() != tree.projects.size())
+            qWarning("qmakereaderbench: unexpected number of projects in the tree");
+
+        writeXml.add(timeWrite(dataProvider.leafProjects(), ResultWriter::Xml));
+        writeBinary.add(timeWrite(dataProvider.leafProjects(), ResultWriter::Binary));
+
+        const qint64 vectorTime = timeScan(scanWorkload, true);
+        const qint64 scalarTime = timeScan(scanWorkload, false);
+        scanVector.add(vectorTime);
+        scanScalar.add(scalarTime);
+        scanVectorTimes << vectorTime;
+        scanScalarTimes << scalarTime;
+
+        ProFileCache listCache;
+        for (int j = 0; j < listProjects.size(); ++j) {
+            timeEvaluateList(listProjects.at(j), &listCache); // Parse outside of the measurement
+            listPhases[j].add(timeEvaluateList(listProjects.at(j), &listCache));
+        }
+
+        int mapHits = 0, hashHits = 0;
+        ProValueMap map;
+        mapInsert.add(timeMapInsert(workload, &map));
+        mapLookup.add(timeMapLookup(workload, map, &mapHits));
+        QHash<ProKey, ProStringList> hash;
+        hashInsert.add(timeMapInsert(workload, &hash));
+        hashLookup.add(timeMapLookup(workload, hash, &hashHits));
+        if (mapHits != hashHits)
+            qWarning("qmakereaderbench: ProValueMap and QHash disagree");
+    }
+
+    QTextStream out(stdout);
+    out << "files: " << tree.files.size() << ", lines: " << tree.lines
+        << ", projects: " << tree.projects.size() << ", iterations: " << params.iterations
+        << "\n\n";
+    out << "     phase   median ms      min ms     files/s     lines/s\n";
+    parse.report(out);
+    evaluate.report(out);
+    evaluateTokens.report(out);
+    readTree.report(out);
+    writeXml.report(out);
+    writeBinary.report(out);
+    std::sort(evaluateTimes.begin(), evaluateTimes.end());
+    std::sort(evaluateTokensTimes.begin(), evaluateTokensTimes.end());
+    out << "lowered token streams: "
+        << QString::number(double(evaluateTokensTimes.at(evaluateTokensTimes.size() / 2))
+                           / qMax<qint64>(evaluateTimes.at(evaluateTimes.size() / 2), 1), 'f', 2)
+        << "x the throughput of the token visitor\n";
+    std::sort(scanVectorTimes.begin(), scanVectorTimes.end());
+    std::sort(scanScalarTimes.begin(), scanScalarTimes.end());
+    const qint64 scanVectorMedian = qMax<qint64>(scanVectorTimes.at(scanVectorTimes.size() / 2), 1);
+    const qint64 scanScalarMedian = scanScalarTimes.at(scanScalarTimes.size() / 2);
+    out << "\nscan: " << scanWorkload.names.size() << " files, " << scanWorkload.lines
+        << " lines, " << QString::number(scanWorkload.bytes / 1048576.0, 'f', 1)
+        << " MiB of text\n\n";
+    out << "     phase   median ms      min ms     files/s     lines/s\n";
+    scanVector.report(out);
+    scanScalar.report(out);
+    out << "vectorized scanning: "
+        << QString::number(double(scanScalarMedian) / scanVectorMedian, 'f', 2)
+        << "x the throughput of the plain loops, "
+        << QString::number(scanWorkload.bytes / (scanVectorMedian / 1e9) / 1048576.0, 'f', 1)
+        << " MiB/s\n";
+    out << "\nlists: " << params.listSize << " values\n\n";
+    out << "     phase   median ms      min ms    values/s\n";
+    foreach (const Phase &phase, listPhases)
+        phase.report(out);
+    out << "\nvalue map: " << workloadFiles.size() << " files, "
+        << workload.assignments.size() << " assignments, " << workload.references.size()
+        << " references\n\n";
+    out << "     phase   median ms      min ms       ops/s\n";
+    mapInsert.report(out);
+    mapLookup.report(out);
+    hashInsert.report(out);
+    hashLookup.report(out);
+    out << "\npeak RSS: " << QString::number(peakResidentSetSize() / 1048576.0, 'f', 1)
+        << " MiB\n";
+    return 0;
+}
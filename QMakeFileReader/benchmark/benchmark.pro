@@ -0,0 +1,28 @@
+QT = core
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+TARGET = qmakereaderbench
+
+DEFINES += PROPARSER_THREAD_SAFE PROEVALUATOR_THREAD_SAFE
+
+include(../evaluator/evaluator.pri)
+
+INCLUDEPATH += ..
+
+HEADERS += \
+    ../evalhandler.h \
+    ../evalprofiler.h \
+    ../qmakedataprovider.h \
+    ../resultcache.h \
+    ../resultwriter.h
+
+SOURCES += \
+    benchmark.cpp \
+    ../evalhandler.cpp \
+    ../evalprofiler.cpp \
+    ../qmakedataprovider.cpp \
+    ../resultcache.cpp \
+    ../resultwriter.cpp
+
+win32: LIBS += -lpsapi
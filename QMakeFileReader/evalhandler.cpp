@@ -4,6 +4,7 @@
 ***************************************************************************************************/
 
 #include "evalhandler.h"
+#include "evalprofiler.h"
 
 void EvalHandler::message(int type, const QString &msg, const QString &fileName, int lineNo)
 {
@@ -21,11 +22,84 @@ void EvalHandler::fileMessage(const QString &msg)
 void EvalHandler::aboutToEval(ProFile *parent, ProFile *proFile, EvalFileType type)
 {
     Q_UNUSED(parent);
-    Q_UNUSED(proFile);
     Q_UNUSED(type);
+    m_evaluatedFiles << proFile->fileName();
+    m_fileNames.insert(proFile, proFile->fileName());
+    if (m_profiler)
+        m_profiler->enterFile(proFile->fileName());
 }
 
 void EvalHandler::doneWithEval(ProFile *parent)
 {
     Q_UNUSED(parent);
+    if (m_profiler)
+        m_profiler->leaveFile();
+}
+
+void EvalHandler::dependsOn(DependencyType type, const QString &path)
+{
+    switch (type) {
+    case DependFileContents:
+        m_evaluatedFiles << path;
+        break;
+    case DependFileExistence:
+        m_probedPaths << path;
+        break;
+    case DependDirectoryContents:
+        m_listedDirectories << path;
+        break;
+    case DependEnvironment:
+        m_environment.insert(path, QString::fromLocal8Bit(qgetenv(path.toLocal8Bit().constData())));
+        break;
+    case DependVolatile:
+        m_volatile = true;
+        break;
+    }
+}
+
+void EvalHandler::aboutToParse(const QString &fileName)
+{
+    if (m_profiler)
+        m_profiler->enterParse(fileName);
+}
+
+void EvalHandler::doneWithParse(const QString &fileName)
+{
+    Q_UNUSED(fileName);
+    if (m_profiler)
+        m_profiler->leaveParse();
+}
+
+void EvalHandler::aboutToCallBuiltin(const ProKey &function)
+{
+    if (m_profiler)
+        m_profiler->enterBuiltin(function.toQString());
+}
+
+void EvalHandler::doneWithBuiltin(const ProKey &function)
+{
+    Q_UNUSED(function);
+    if (m_profiler)
+        m_profiler->leaveBuiltin();
+}
+
+QString EvalHandler::sourceFileName(const ProFile *proFile) const
+{
+    return m_fileNames.value(proFile);
+}
+
+EvalDependencies EvalHandler::takeDependencies()
+{
+    EvalDependencies dependencies;
+    dependencies.files.swap(m_evaluatedFiles);
+    dependencies.files.removeDuplicates();
+    dependencies.probedPaths = m_probedPaths.toList();
+    dependencies.listedDirectories = m_listedDirectories.toList();
+    dependencies.environment.swap(m_environment);
+    dependencies.isVolatile = m_volatile;
+    m_fileNames.clear();
+    m_probedPaths.clear();
+    m_listedDirectories.clear();
+    m_volatile = false;
+    return dependencies;
 }
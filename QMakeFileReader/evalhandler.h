@@ -7,17 +7,64 @@
 #define EVALHANDLER_H
 
 #include <qmakeevaluator.h>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
 
 /**
- * Dummy handler to please qmake's parser.
+ * What an evaluation depended on: the files it read, the paths whose existence it tested, the
+ * directories whose contents it listed and the environment variables it read, with their
+ * values. If it used inputs which cannot be checked later, like the output of commands, it is
+ * volatile.
+ */
+class EvalProfiler;
+
+struct EvalDependencies
+{
+    EvalDependencies() : isVolatile(false) {}
+
+    QStringList files;
+    QStringList probedPaths;
+    QStringList listedDirectories;
+    QHash<QString, QString> environment;
+    bool isVolatile;
+};
+
+/**
+ * Handler to please qmake's parser. Messages are dropped; the names of evaluated files and the
+ * other paths the evaluation looked at are collected, so that a caller can tell what a result
+ * depends on and which file a value was assigned in. If a profiler is set, it is fed with the
+ * evaluated files, parsing and builtin calls.
  */
 class EvalHandler : public QMakeHandler
 {
 public:
+    EvalHandler() : m_volatile(false), m_profiler(0) {}
+
     void message(int type, const QString &msg, const QString &fileName, int lineNo);
     void fileMessage(const QString &msg);
     void aboutToEval(ProFile *parent, ProFile *proFile, EvalFileType type);
     void doneWithEval(ProFile *parent);
+    void dependsOn(DependencyType type, const QString &path);
+    void aboutToParse(const QString &fileName);
+    void doneWithParse(const QString &fileName);
+    void aboutToCallBuiltin(const ProKey &function);
+    void doneWithBuiltin(const ProKey &function);
+
+    void setProfiler(EvalProfiler *profiler) { m_profiler = profiler; }
+
+    QString sourceFileName(const ProFile *proFile) const;
+    EvalDependencies takeDependencies();
+
+private:
+    QStringList m_evaluatedFiles;
+    QSet<QString> m_probedPaths;
+    QSet<QString> m_listedDirectories;
+    QHash<QString, QString> m_environment;
+    bool m_volatile;
+    // Only files seen through aboutToEval(); blocks from eval() and the like may be gone already.
+    QHash<const ProFile *, QString> m_fileNames;
+    EvalProfiler *m_profiler;
 };
 
 #endif // EVALHANDLER_H
@@ -0,0 +1,213 @@
+/***************************************************************************************************
+ Copyright (C) 2024 The Qt Company Ltd.
+ SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only WITH Qt-GPL-exception-1.0
+***************************************************************************************************/
+
+#include "evalprofiler.h"
+#include <QtCore/QList>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+
+#include <algorithm>
+
+namespace {
+
+QString milliseconds(qint64 nsecs)
+{
+    return QString::number(nsecs / 1000000.0, 'f', 3);
+}
+
+} // namespace
+
+EvalProfiler::EvalProfiler()
+{
+    m_timer.start();
+}
+
+void EvalProfiler::enterFile(const QString &fileName)
+{
+    enter(FileFrame, fileName);
+}
+
+void EvalProfiler::leaveFile()
+{
+    leave(FileFrame);
+}
+
+void EvalProfiler::enterParse(const QString &fileName)
+{
+    enter(ParseFrame, fileName);
+}
+
+void EvalProfiler::leaveParse()
+{
+    leave(ParseFrame);
+}
+
+void EvalProfiler::enterBuiltin(const QString &function)
+{
+    enter(BuiltinFrame, function);
+}
+
+void EvalProfiler::leaveBuiltin()
+{
+    leave(BuiltinFrame);
+}
+
+void EvalProfiler::enter(FrameType type, const QString &name)
+{
+    QString frameName = name;
+    frameName.replace(QLatin1Char(';'), QLatin1Char(','));
+    if (type == ParseFrame)
+        frameName += QLatin1String(" [parse]");
+    else if (type == BuiltinFrame)
+        frameName += QLatin1String("()");
+
+    Frame frame;
+    frame.type = type;
+    frame.name = name;
+    frame.stack = m_frames.isEmpty()
+            ? frameName : m_frames.last().stack + QLatin1Char(';') + frameName;
+    frame.start = m_timer.nsecsElapsed();
+    frame.childTime = 0;
+    m_frames.append(frame);
+}
+
+void EvalProfiler::leave(FrameType type)
+{
+    // Tolerate unbalanced notifications rather than attributing time to the wrong frame.
+    if (m_frames.isEmpty() || m_frames.last().type != type)
+        return;
+
+    const Frame frame = m_frames.takeLast();
+    const qint64 time = m_timer.nsecsElapsed() - frame.start;
+    const qint64 selfTime = time - frame.childTime;
+    if (!m_frames.isEmpty())
+        m_frames.last().childTime += time;
+    m_stacks[frame.stack] += selfTime;
+
+    switch (type) {
+    case FileFrame: {
+        FileStats &stats = m_files[frame.name];
+        ++stats.evaluations;
+        stats.evalTime += time;
+        stats.selfTime += selfTime;
+        break;
+    }
+    case ParseFrame: {
+        FileStats &stats = m_files[frame.name];
+        ++stats.parses;
+        stats.parseTime += time;
+        break;
+    }
+    case BuiltinFrame: {
+        BuiltinStats &stats = m_builtins[frame.name];
+        ++stats.calls;
+        stats.time += time;
+        break;
+    }
+    }
+}
+
+void EvalProfiler::setCounter(const QString &name, qint64 value)
+{
+    m_counters[name] = value;
+}
+
+void EvalProfiler::merge(const EvalProfiler &other)
+{
+    for (QHash<QString, qint64>::ConstIterator it = other.m_stacks.constBegin();
+         it != other.m_stacks.constEnd(); ++it) {
+        m_stacks[it.key()] += it.value();
+    }
+    for (QHash<QString, FileStats>::ConstIterator it = other.m_files.constBegin();
+         it != other.m_files.constEnd(); ++it) {
+        FileStats &stats = m_files[it.key()];
+        stats.evaluations += it->evaluations;
+        stats.parses += it->parses;
+        stats.evalTime += it->evalTime;
+        stats.selfTime += it->selfTime;
+        stats.parseTime += it->parseTime;
+    }
+    for (QHash<QString, BuiltinStats>::ConstIterator it = other.m_builtins.constBegin();
+         it != other.m_builtins.constEnd(); ++it) {
+        BuiltinStats &stats = m_builtins[it.key()];
+        stats.calls += it->calls;
+        stats.time += it->time;
+    }
+    for (QMap<QString, qint64>::ConstIterator it = other.m_counters.constBegin();
+         it != other.m_counters.constEnd(); ++it) {
+        m_counters[it.key()] += it.value();
+    }
+}
+
+void EvalProfiler::writeCollapsedStacks(QTextStream &stream) const
+{
+    QStringList stacks = m_stacks.keys();
+    stacks.sort();
+    foreach (const QString &stack, stacks) {
+        const qint64 usecs = m_stacks.value(stack) / 1000;
+        if (usecs > 0)
+            stream << stack << ' ' << usecs << '\n';
+    }
+}
+
+void EvalProfiler::writeSummary(QTextStream &stream) const
+{
+    struct FileEntry
+    {
+        QString name;
+        FileStats stats;
+        qint64 time() const { return stats.evalTime + stats.parseTime; }
+        bool operator<(const FileEntry &other) const { return time() > other.time(); }
+    };
+    QList<FileEntry> files;
+    for (QHash<QString, FileStats>::ConstIterator it = m_files.constBegin();
+         it != m_files.constEnd(); ++it) {
+        FileEntry entry = { it.key(), it.value() };
+        files << entry;
+    }
+    std::sort(files.begin(), files.end());
+
+    stream << "evals  parses   eval ms   self ms  parse ms  file\n";
+    foreach (const FileEntry &entry, files) {
+        stream << qSetFieldWidth(5) << entry.stats.evaluations << qSetFieldWidth(0) << ' '
+               << qSetFieldWidth(7) << entry.stats.parses << qSetFieldWidth(0) << ' '
+               << qSetFieldWidth(9) << milliseconds(entry.stats.evalTime) << qSetFieldWidth(0)
+               << ' '
+               << qSetFieldWidth(9) << milliseconds(entry.stats.selfTime) << qSetFieldWidth(0)
+               << ' '
+               << qSetFieldWidth(9) << milliseconds(entry.stats.parseTime) << qSetFieldWidth(0)
+               << "  " << entry.name << '\n';
+    }
+
+    struct BuiltinEntry
+    {
+        QString name;
+        BuiltinStats stats;
+        bool operator<(const BuiltinEntry &other) const { return stats.time > other.stats.time; }
+    };
+    QList<BuiltinEntry> builtins;
+    for (QHash<QString, BuiltinStats>::ConstIterator it = m_builtins.constBegin();
+         it != m_builtins.constEnd(); ++it) {
+        BuiltinEntry entry = { it.key(), it.value() };
+        builtins << entry;
+    }
+    std::sort(builtins.begin(), builtins.end());
+
+    stream << "\n  calls   time ms  builtin\n";
+    foreach (const BuiltinEntry &entry, builtins) {
+        stream << qSetFieldWidth(7) << entry.stats.calls << qSetFieldWidth(0) << ' '
+               << qSetFieldWidth(9) << milliseconds(entry.stats.time) << qSetFieldWidth(0)
+               << "  " << entry.name << '\n';
+    }
+
+    if (m_counters.isEmpty())
+        return;
+    stream << "\n      count  counter\n";
+    for (QMap<QString, qint64>::ConstIterator it = m_counters.constBegin();
+         it != m_counters.constEnd(); ++it) {
+        stream << qSetFieldWidth(11) << it.value() << qSetFieldWidth(0) << "  " << it.key()
+               << '\n';
+    }
+}
@@ -0,0 +1,92 @@
+/***************************************************************************************************
+ Copyright (C) 2024 The Qt Company Ltd.
+ SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only WITH Qt-GPL-exception-1.0
+***************************************************************************************************/
+
+#ifndef EVALPROFILER_H
+#define EVALPROFILER_H
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+class QTextStream;
+QT_END_NAMESPACE
+
+/**
+ * Measures where an evaluation spends its time. The evaluation is seen as a tree of frames:
+ * evaluated files, parsing of files and calls of builtin functions, as reported by EvalHandler.
+ * The time of every frame minus the time of its children is accumulated per stack of frames,
+ * and totals are kept per file and per builtin.
+ *
+ * A profiler is fed from one thread only; profilers of concurrent evaluations are merged.
+ */
+class EvalProfiler
+{
+public:
+    EvalProfiler();
+
+    void enterFile(const QString &fileName);
+    void leaveFile();
+    void enterParse(const QString &fileName);
+    void leaveParse();
+    void enterBuiltin(const QString &function);
+    void leaveBuiltin();
+
+    // Sets a named counter of the evaluator, e.g. the hits of one of its caches.
+    void setCounter(const QString &name, qint64 value);
+
+    void merge(const EvalProfiler &other);
+
+    // One line per stack, frames separated by semicolons, followed by the self time in
+    // microseconds. This is the input format of flamegraph.pl and compatible tools.
+    void writeCollapsedStacks(QTextStream &stream) const;
+    // Tables of the files and builtins, sorted by decreasing time, and of the counters.
+    void writeSummary(QTextStream &stream) const;
+
+private:
+    enum FrameType { FileFrame, ParseFrame, BuiltinFrame };
+
+    struct Frame
+    {
+        FrameType type;
+        QString name;
+        QString stack;
+        qint64 start;
+        qint64 childTime;
+    };
+
+    struct FileStats
+    {
+        FileStats() : evaluations(0), parses(0), evalTime(0), selfTime(0), parseTime(0) {}
+
+        int evaluations;
+        int parses;
+        qint64 evalTime;
+        qint64 selfTime;
+        qint64 parseTime;
+    };
+
+    struct BuiltinStats
+    {
+        BuiltinStats() : calls(0), time(0) {}
+
+        int calls;
+        qint64 time;
+    };
+
+    void enter(FrameType type, const QString &name);
+    void leave(FrameType type);
+
+    QElapsedTimer m_timer;
+    QVector<Frame> m_frames;
+    QHash<QString, qint64> m_stacks;
+    QHash<QString, FileStats> m_files;
+    QHash<QString, BuiltinStats> m_builtins;
+    QMap<QString, qint64> m_counters;
+};
+
+#endif // EVALPROFILER_H
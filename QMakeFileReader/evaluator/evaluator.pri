@@ -7,6 +7,7 @@ INCLUDEPATH += \
 HEADERS += \
     $$PWD/ioutils.h \
     $$PWD/proitems.h \
+    $$PWD/qmakecachefile.h \
     $$PWD/qmakeevaluator.h \
     $$PWD/qmakeevaluator_p.h \
     $$PWD/qmakeglobals.h \
@@ -17,6 +18,8 @@ SOURCES += \
     $$PWD/ioutils.cpp \
     $$PWD/proitems.cpp \
     $$PWD/qmakebuiltins.cpp \
+    $$PWD/qmakedemand.cpp \
     $$PWD/qmakeevaluator.cpp \
     $$PWD/qmakeglobals.cpp \
-    $$PWD/qmakeparser.cpp
+    $$PWD/qmakeparser.cpp \
+    $$PWD/qmakesnapshot.cpp
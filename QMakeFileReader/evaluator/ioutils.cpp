@@ -7,15 +7,25 @@
 
 #include <qdir.h>
 #include <qfile.h>
+#ifdef PROEVALUATOR_THREAD_SAFE
+#  include <qrunnable.h>
+#  include <qsharedpointer.h>
+#  include <qthread.h>
+#  include <qthreadpool.h>
+#  include <qwaitcondition.h>
+#endif
 
 #ifdef Q_OS_WIN
 #  include <windows.h>
 #else
 #  include <sys/types.h>
 #  include <sys/stat.h>
+#  include <dirent.h>
 #  include <unistd.h>
 #endif
 
+#include <algorithm>
+
 QT_BEGIN_NAMESPACE
 
 using namespace QMakeInternal;
@@ -36,6 +46,225 @@ IoUtils::FileType IoUtils::fileType(const QString &fileName)
 #endif
 }
 
+static bool dirEntryLessThan(const IoUtils::DirEntry &one, const IoUtils::DirEntry &two)
+{
+    return one.name.compare(two.name, Qt::CaseInsensitive) < 0;
+}
+
+QVector<IoUtils::DirEntry> IoUtils::readDirectory(const QString &dirName)
+{
+    QVector<DirEntry> entries;
+    DirEntry entry;
+#ifdef Q_OS_WIN
+    QString pattern = QDir::toNativeSeparators(dirName);
+    if (!pattern.endsWith(QLatin1Char('\\')))
+        pattern += QLatin1Char('\\');
+    pattern += QLatin1Char('*');
+    WIN32_FIND_DATAW data;
+    HANDLE handle = FindFirstFileExW((WCHAR*)pattern.utf16(), FindExInfoBasic, &data,
+                                     FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (handle == INVALID_HANDLE_VALUE)
+        return entries;
+    do {
+        if (data.dwFileAttributes & (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM))
+            continue;
+        entry.name = QString::fromWCharArray(data.cFileName);
+        if (entry.name == QLatin1String(".") || entry.name == QLatin1String(".."))
+            continue;
+        entry.type = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? FileIsDir : FileIsRegular;
+        entries << entry;
+    } while (FindNextFileW(handle, &data));
+    FindClose(handle);
+#else
+    QByteArray path = dirName.toLocal8Bit();
+    if (!path.endsWith('/'))
+        path += '/';
+    DIR *dir = ::opendir(path.constData());
+    if (!dir)
+        return entries;
+    const int pathLen = path.length();
+    while (struct dirent *ent = ::readdir(dir)) {
+        if (ent->d_name[0] == '.') // Hidden, which includes . and ..
+            continue;
+# ifdef DT_DIR
+        if (ent->d_type == DT_REG) {
+            entry.type = FileIsRegular;
+        } else if (ent->d_type == DT_DIR) {
+            entry.type = FileIsDir;
+        } else if (ent->d_type == DT_LNK || ent->d_type == DT_UNKNOWN)
+# endif
+        {
+            // Symlinks are followed, and some file systems do not report types.
+            path.truncate(pathLen);
+            path += ent->d_name;
+            struct ::stat st;
+            if (::stat(path.constData(), &st))
+                continue;
+            if (S_ISDIR(st.st_mode))
+                entry.type = FileIsDir;
+            else if (S_ISREG(st.st_mode))
+                entry.type = FileIsRegular;
+            else
+                continue;
+        }
+# ifdef DT_DIR
+        else {
+            continue; // Devices, sockets, etc., which QDir considers system files
+        }
+# endif
+        entry.name = QString::fromLocal8Bit(ent->d_name);
+        entries << entry;
+    }
+    ::closedir(dir);
+#endif
+    std::sort(entries.begin(), entries.end(), dirEntryLessThan);
+    return entries;
+}
+
+IoUtils::FileType FileTypeCache::fileType(const QString &fileName)
+{
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&m_mutex);
+#endif
+    QHash<QString, IoUtils::FileType>::ConstIterator it = m_types.constFind(fileName);
+    if (it != m_types.constEnd()) {
+        ++m_hits;
+        return *it;
+    }
+    ++m_misses;
+    QString key = fileName;
+    key.detach(); // The name may be an m_tmp
+#ifdef PROEVALUATOR_THREAD_SAFE
+    // Concurrent evaluations sharing the cache may stat the same path twice,
+    // which is cheaper than serializing all of them on the file system.
+    locker.unlock();
+#endif
+    const IoUtils::FileType type = IoUtils::fileType(key);
+#ifdef PROEVALUATOR_THREAD_SAFE
+    locker.relock();
+#endif
+    m_types.insert(key, type);
+    return type;
+}
+
+QVector<IoUtils::DirEntry> FileTypeCache::directoryEntries(const QString &dirName)
+{
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&m_mutex);
+#endif
+    QHash<QString, QVector<IoUtils::DirEntry> >::ConstIterator it =
+            m_directories.constFind(dirName);
+    if (it != m_directories.constEnd()) {
+        ++m_hits;
+        return *it;
+    }
+    ++m_misses;
+    QString key = dirName;
+    key.detach();
+#ifdef PROEVALUATOR_THREAD_SAFE
+    locker.unlock();
+#endif
+    const QVector<IoUtils::DirEntry> entries = IoUtils::readDirectory(key);
+#ifdef PROEVALUATOR_THREAD_SAFE
+    locker.relock();
+#endif
+    m_directories.insert(key, entries);
+    // The listing answers the type queries for the entries as well.
+    foreach (const IoUtils::DirEntry &entry, entries)
+        m_types.insert(key + entry.name, entry.type);
+    return entries;
+}
+
+#ifdef PROEVALUATOR_THREAD_SAFE
+namespace {
+
+// The state of a breadth-first listing of a tree. The thread starting it lists
+// directories along with helpers started on idle threads of the global pool.
+// Helpers are only started if a thread is free right away, so the walk cannot
+// starve, and they share the state, as they may still be unlocking it when the
+// walk is done.
+struct TreeWalk
+{
+    TreeWalk(FileTypeCache *_cache) : cache(_cache), busy(0), helpers(0) {}
+
+    FileTypeCache *cache;
+    QMutex mutex;
+    QWaitCondition cond;
+    QStringList pending;
+    int busy;
+    int helpers;
+};
+
+void listNext(const QSharedPointer<TreeWalk> &walk, QMutexLocker *locker);
+
+class TreeWalkHelper : public QRunnable
+{
+public:
+    TreeWalkHelper(const QSharedPointer<TreeWalk> &walk) : m_walk(walk) {}
+
+    void run()
+    {
+        QMutexLocker locker(&m_walk->mutex);
+        while (!m_walk->pending.isEmpty())
+            listNext(m_walk, &locker);
+        --m_walk->helpers;
+        m_walk->cond.wakeAll();
+    }
+
+private:
+    QSharedPointer<TreeWalk> m_walk;
+};
+
+void listNext(const QSharedPointer<TreeWalk> &walk, QMutexLocker *locker)
+{
+    const QString dirName = walk->pending.takeFirst();
+    ++walk->busy;
+    locker->unlock();
+    const QVector<IoUtils::DirEntry> entries = walk->cache->directoryEntries(dirName);
+    locker->relock();
+    --walk->busy;
+    foreach (const IoUtils::DirEntry &entry, entries)
+        if (entry.type == IoUtils::FileIsDir)
+            walk->pending << (dirName + entry.name + QLatin1Char('/'));
+    // Small trees are not worth the threads.
+    while (walk->pending.size() > 4 && walk->helpers < QThread::idealThreadCount() - 1) {
+        TreeWalkHelper *helper = new TreeWalkHelper(walk);
+        if (!QThreadPool::globalInstance()->tryStart(helper)) {
+            delete helper;
+            break;
+        }
+        ++walk->helpers;
+    }
+    walk->cond.wakeAll();
+}
+
+}
+
+void FileTypeCache::prefetchTree(const QString &dirName)
+{
+    QSharedPointer<TreeWalk> walk(new TreeWalk(this));
+    QMutexLocker locker(&walk->mutex);
+    walk->pending << dirName;
+    forever {
+        if (!walk->pending.isEmpty())
+            listNext(walk, &locker);
+        else if (walk->busy || walk->helpers)
+            walk->cond.wait(&walk->mutex);
+        else
+            break;
+    }
+}
+#endif
+
+void FileTypeCache::clear()
+{
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&m_mutex);
+#endif
+    m_types.clear();
+    m_directories.clear();
+}
+
 bool IoUtils::isRelativePath(const QString &path)
 {
     if (path.startsWith(QLatin1Char('/')))
@@ -6,7 +6,12 @@
 #ifndef IOUTILS_H
 #define IOUTILS_H
 
+#include <qhash.h>
 #include <qstring.h>
+#include <qvector.h>
+#ifdef PROEVALUATOR_THREAD_SAFE
+# include <qmutex.h>
+#endif
 
 QT_BEGIN_NAMESPACE
 
@@ -24,7 +29,15 @@ public:
         FileIsDir = 2
     };
 
+    struct DirEntry {
+        QString name;
+        FileType type;
+    };
+
     static FileType fileType(const QString &fileName);
+    // The regular files and directories in dirName which QDir lists by default, in its
+    // default order. Hidden entries are left out.
+    static QVector<DirEntry> readDirectory(const QString &dirName);
     static bool exists(const QString &fileName) { return fileType(fileName) != FileNotFound; }
     static bool isRelativePath(const QString &fileName);
     static bool isAbsolutePath(const QString &fileName) { return !isRelativePath(fileName); }
@@ -40,6 +53,38 @@ public:
 #endif
 };
 
+/*!
+  Remembers the types of the files asked for, including the ones that do
+  not exist, so that every path is stat'ed only once, and the contents of
+  the directories listed. The file system is assumed not to change while
+  the cache is in use.
+*/
+class FileTypeCache {
+public:
+    FileTypeCache() : m_hits(0), m_misses(0) {}
+
+    IoUtils::FileType fileType(const QString &fileName);
+    bool exists(const QString &fileName) { return fileType(fileName) != IoUtils::FileNotFound; }
+    // dirName must end with a slash.
+    QVector<IoUtils::DirEntry> directoryEntries(const QString &dirName);
+#ifdef PROEVALUATOR_THREAD_SAFE
+    // Lists dirName and all directories below it, using idle threads of the global pool.
+    void prefetchTree(const QString &dirName);
+#endif
+    void clear();
+
+    qint64 hits() const { return m_hits; }
+    qint64 misses() const { return m_misses; }
+
+private:
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutex m_mutex;
+#endif
+    QHash<QString, IoUtils::FileType> m_types;
+    QHash<QString, QVector<IoUtils::DirEntry> > m_directories;
+    qint64 m_hits, m_misses;
+};
+
 } // namespace ProFileEvaluatorInternal
 
 QT_END_NAMESPACE
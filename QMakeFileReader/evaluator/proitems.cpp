@@ -9,6 +9,9 @@
 #include <qset.h>
 #include <qstringlist.h>
 #include <qtextstream.h>
+#ifdef PROPARSER_THREAD_SAFE
+# include <qmutex.h>
+#endif
 
 QT_BEGIN_NAMESPACE
 
@@ -26,61 +29,61 @@ uint ProString::hash(const QChar *p, int n)
 }
 
 ProString::ProString() :
-    m_offset(0), m_length(0), m_file(0), m_hash(0x80000000)
+    m_offset(0), m_length(0), m_file(0), m_hash(0x80000000), m_atom(0)
 {
 }
 
 ProString::ProString(const ProString &other) :
-    m_string(other.m_string), m_offset(other.m_offset), m_length(other.m_length), m_file(other.m_file), m_hash(other.m_hash)
+    m_string(other.m_string), m_offset(other.m_offset), m_length(other.m_length), m_file(other.m_file), m_hash(other.m_hash), m_atom(other.m_atom)
 {
 }
 
 ProString::ProString(const ProString &other, OmitPreHashing) :
-    m_string(other.m_string), m_offset(other.m_offset), m_length(other.m_length), m_file(other.m_file), m_hash(0x80000000)
+    m_string(other.m_string), m_offset(other.m_offset), m_length(other.m_length), m_file(other.m_file), m_hash(0x80000000), m_atom(0)
 {
 }
 
 ProString::ProString(const QString &str, DoPreHashing) :
-    m_string(str), m_offset(0), m_length(str.length()), m_file(0)
+    m_string(str), m_offset(0), m_length(str.length()), m_file(0), m_atom(0)
 {
     updatedHash();
 }
 
 ProString::ProString(const QString &str) :
-    m_string(str), m_offset(0), m_length(str.length()), m_file(0), m_hash(0x80000000)
+    m_string(str), m_offset(0), m_length(str.length()), m_file(0), m_hash(0x80000000), m_atom(0)
 {
 }
 
 ProString::ProString(const char *str, DoPreHashing) :
-    m_string(QString::fromLatin1(str)), m_offset(0), m_length(qstrlen(str)), m_file(0)
+    m_string(QString::fromLatin1(str)), m_offset(0), m_length(qstrlen(str)), m_file(0), m_atom(0)
 {
     updatedHash();
 }
 
 ProString::ProString(const char *str) :
-    m_string(QString::fromLatin1(str)), m_offset(0), m_length(qstrlen(str)), m_file(0), m_hash(0x80000000)
+    m_string(QString::fromLatin1(str)), m_offset(0), m_length(qstrlen(str)), m_file(0), m_hash(0x80000000), m_atom(0)
 {
 }
 
 ProString::ProString(const QString &str, int offset, int length, DoPreHashing) :
-    m_string(str), m_offset(offset), m_length(length), m_file(0)
+    m_string(str), m_offset(offset), m_length(length), m_file(0), m_atom(0)
 {
     updatedHash();
 }
 
 ProString::ProString(const QString &str, int offset, int length, uint hash) :
-    m_string(str), m_offset(offset), m_length(length), m_file(0), m_hash(hash)
+    m_string(str), m_offset(offset), m_length(length), m_file(0), m_hash(hash), m_atom(0)
 {
 }
 
 ProString::ProString(const QString &str, int offset, int length) :
-    m_string(str), m_offset(offset), m_length(length), m_file(0), m_hash(0x80000000)
+    m_string(str), m_offset(offset), m_length(length), m_file(0), m_hash(0x80000000), m_atom(0)
 {
 }
 
 void ProString::setValue(const QString &str)
 {
-    m_string = str, m_offset = 0, m_length = str.length(), m_hash = 0x80000000;
+    m_string = str, m_offset = 0, m_length = str.length(), m_hash = 0x80000000, m_atom = 0;
 }
 
 uint ProString::updatedHash() const
@@ -115,12 +118,51 @@ ProKey::ProKey(const QString &str, int off, int len, uint hash) :
 {
 }
 
+ProKey::ProKey(const QString &str, int off, int len, uint hash, ushort atom) :
+    ProString(str, off, len, hash)
+{
+    m_atom = atom;
+}
+
 void ProKey::setValue(const QString &str)
 {
-    m_string = str, m_offset = 0, m_length = str.length();
+    m_string = str, m_offset = 0, m_length = str.length(), m_atom = 0;
     updatedHash();
 }
 
+namespace {
+
+struct ProAtomTable
+{
+#ifdef PROPARSER_THREAD_SAFE
+    QMutex mutex;
+#endif
+    QHash<ProKey, ushort> atoms;
+};
+
+}
+
+Q_GLOBAL_STATIC(ProAtomTable, atomTable)
+
+ushort ProKey::intern()
+{
+    if (m_atom)
+        return m_atom;
+    ProAtomTable *table = atomTable();
+#ifdef PROPARSER_THREAD_SAFE
+    QMutexLocker locker(&table->mutex);
+#endif
+    QHash<ProKey, ushort>::ConstIterator it = table->atoms.constFind(*this);
+    if (it != table->atoms.constEnd()) {
+        m_atom = *it;
+    } else if (table->atoms.size() < 0xffff) {
+        // Deep copy, the key might be a substring of a token stream.
+        m_atom = ushort(table->atoms.size() + 1);
+        table->atoms.insert(ProKey(toQString()), m_atom);
+    }
+    return m_atom;
+}
+
 QString ProString::toQString() const
 {
     return m_string.mid(m_offset, m_length);
@@ -143,6 +185,7 @@ QChar *ProString::prepareExtend(int extraLen, int thisTarget, int extraTarget)
         m_length += extraLen;
         m_string.resize(m_length);
         m_hash = 0x80000000;
+        m_atom = 0;
         return ptr;
     } else {
         QString neu(m_length + extraLen, Qt::Uninitialized);
@@ -362,6 +405,22 @@ void ProStringList::removeDuplicates()
 {
     int n = size();
     int j = 0;
+    if (qint64(n) * n < HashThreshold) {
+        for (int i = 0; i < n; ++i) {
+            const ProString &s = at(i);
+            int k = 0;
+            while (k < j && at(k) != s)
+                ++k;
+            if (k < j)
+                continue;
+            if (j != i)
+                (*this)[j] = s;
+            ++j;
+        }
+        if (n != j)
+            erase(begin() + j, end());
+        return;
+    }
     QSet<ProString> seen;
     seen.reserve(n);
     for (int i = 0; i < n; ++i) {
@@ -409,8 +468,251 @@ bool ProStringList::contains(const char *str, Qt::CaseSensitivity cs) const
     return false;
 }
 
+ProValueMap::Data::Data(const Data &other) :
+    QSharedData(other), size(0), entryCount(0), removed(0)
+{
+    // The copy is compacted, as references into the original do not apply to it anyway.
+    for (int i = 0; i < other.entryCount; ++i) {
+        const Entry &src = other.entry(i);
+        if (src.used) {
+            if (!(entryCount & (BlockSize - 1)))
+                blocks << new Entry[BlockSize];
+            Entry &dst = entry(entryCount++);
+            dst.key = src.key;
+            dst.value = src.value;
+            dst.used = true;
+        }
+    }
+    size = entryCount;
+    rehash();
+}
+
+ProValueMap::Data::~Data()
+{
+    foreach (Entry *block, blocks)
+        delete[] block;
+}
+
+int ProValueMap::Data::find(const ProKey &key) const
+{
+    if (table.isEmpty())
+        return -1;
+    const uint hash = qHash(key);
+    const int mask = table.size() - 1;
+    const Slot *slots = table.constData();
+    for (int idx = hash & mask; ; idx = (idx + 1) & mask) {
+        const Slot &slot = slots[idx];
+        if (slot.entry == EmptySlot)
+            return -1;
+        if (slot.hash == hash && slot.entry >= 0 && entry(slot.entry).key == key)
+            return slot.entry;
+    }
+}
+
+// The key must not be in the map yet.
+int ProValueMap::Data::insert(const ProKey &key)
+{
+    if ((size + removed + 1) * 4 > table.size() * 3)
+        rehash();
+
+    int index;
+    if (!freeEntries.isEmpty()) {
+        index = freeEntries.takeLast();
+    } else {
+        if (!(entryCount & (BlockSize - 1)))
+            blocks << new Entry[BlockSize];
+        index = entryCount++;
+    }
+    const uint hash = qHash(key);
+    Entry &ent = entry(index);
+    ent.key = key;
+    ent.used = true;
+    ++size;
+
+    const int mask = table.size() - 1;
+    Slot *slots = table.data();
+    int idx = hash & mask;
+    while (slots[idx].entry >= 0)
+        idx = (idx + 1) & mask;
+    if (slots[idx].entry == RemovedSlot)
+        --removed;
+    slots[idx].hash = hash;
+    slots[idx].entry = index;
+    return index;
+}
+
+void ProValueMap::Data::erase(int index)
+{
+    Entry &ent = entry(index);
+    const int mask = table.size() - 1;
+    int idx = qHash(ent.key) & mask;
+    while (table.at(idx).entry != index)
+        idx = (idx + 1) & mask;
+    table[idx].entry = RemovedSlot;
+    ++removed;
+
+    ent.key = ProKey();
+    ent.value = ProStringList();
+    ent.used = false;
+    freeEntries << index;
+    --size;
+}
+
+// Makes room for one more entry, keeping the load factor at most 1/2 afterwards.
+void ProValueMap::Data::rehash()
+{
+    int capacity = 8;
+    while (capacity < (size + 1) * 2)
+        capacity <<= 1;
+    const Slot empty = { 0, EmptySlot };
+    table.fill(empty, capacity);
+    removed = 0;
+
+    const int mask = capacity - 1;
+    Slot *slots = table.data();
+    for (int i = 0; i < entryCount; ++i) {
+        const Entry &ent = entry(i);
+        if (!ent.used)
+            continue;
+        const uint hash = qHash(ent.key);
+        int idx = hash & mask;
+        while (slots[idx].entry != EmptySlot)
+            idx = (idx + 1) & mask;
+        slots[idx].hash = hash;
+        slots[idx].entry = i;
+    }
+}
+
+ProValueMap::ProValueMap()
+{
+}
+
+ProValueMap::ProValueMap(const ProValueMap &other) :
+    d(other.d)
+{
+}
+
+ProValueMap::~ProValueMap()
+{
+}
+
+ProValueMap &ProValueMap::operator=(const ProValueMap &other)
+{
+    d = other.d;
+    return *this;
+}
+
+ProValueMap::Data *ProValueMap::detached()
+{
+    if (!d)
+        d = new Data;
+    return d.data();
+}
+
+int ProValueMap::size() const
+{
+    return d ? d->size : 0;
+}
+
+void ProValueMap::clear()
+{
+    d = QSharedDataPointer<Data>();
+}
+
+ProStringList ProValueMap::value(const ProKey &key) const
+{
+    const int index = lookup(key);
+    return index < 0 ? ProStringList() : d->entry(index).value;
+}
+
+ProStringList &ProValueMap::operator[](const ProKey &key)
+{
+    Data *data = detached();
+    int index = data->find(key);
+    if (index < 0)
+        index = data->insert(key);
+    return data->entry(index).value;
+}
+
+ProValueMap::Iterator ProValueMap::insert(const ProKey &key, const ProStringList &value)
+{
+    Data *data = detached();
+    int index = data->find(key);
+    if (index < 0)
+        index = data->insert(key);
+    data->entry(index).value = value;
+    return Iterator(data, index);
+}
+
+int ProValueMap::remove(const ProKey &key)
+{
+    if (lookup(key) < 0)
+        return 0;
+    // Detaching renumbers the entries.
+    Data *data = detached();
+    data->erase(data->find(key));
+    return 1;
+}
+
+ProValueMap::Iterator ProValueMap::erase(Iterator it)
+{
+    Q_ASSERT(it.d == d.constData() && it.d->ref.load() == 1);
+    const int following = next(it.d, it.i);
+    it.d->erase(it.i);
+    return Iterator(it.d, following);
+}
+
+ProValueMap::Iterator ProValueMap::find(const ProKey &key)
+{
+    if (!d)
+        return Iterator();
+    Data *data = d.data();
+    const int index = data->find(key);
+    return Iterator(data, index < 0 ? data->entryCount : index);
+}
+
+ProValueMap::ConstIterator ProValueMap::constFind(const ProKey &key) const
+{
+    const int index = lookup(key);
+    return index < 0 ? constEnd() : ConstIterator(d.constData(), index);
+}
+
+ProValueMap::Iterator ProValueMap::begin()
+{
+    if (!d)
+        return Iterator();
+    Data *data = d.data();
+    return Iterator(data, next(data, -1));
+}
+
+ProValueMap::Iterator ProValueMap::end()
+{
+    if (!d)
+        return Iterator();
+    Data *data = d.data();
+    return Iterator(data, data->entryCount);
+}
+
+ProValueMap::ConstIterator ProValueMap::constBegin() const
+{
+    if (!d)
+        return ConstIterator();
+    const Data *data = d.constData();
+    return ConstIterator(data, next(data, -1));
+}
+
+ProValueMap::ConstIterator ProValueMap::constEnd() const
+{
+    if (!d)
+        return ConstIterator();
+    const Data *data = d.constData();
+    return ConstIterator(data, data->entryCount);
+}
+
 ProFile::ProFile(const QString &fileName)
     : m_refCount(1),
+      m_code(0),
+      m_visits(0),
       m_fileName(fileName),
       m_ok(true),
       m_hostBuild(false)
@@ -422,6 +724,15 @@ ProFile::ProFile(const QString &fileName)
 
 ProFile::~ProFile()
 {
+    delete m_code.loadAcquire();
+}
+
+const ProCode *ProFile::setCode(ProCode *code)
+{
+    if (m_code.testAndSetOrdered(0, code))
+        return code;
+    delete code;
+    return m_code.loadAcquire();
 }
 
 QT_END_NAMESPACE
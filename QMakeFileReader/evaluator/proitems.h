@@ -11,6 +11,8 @@
 #include <qstring.h>
 #include <qvector.h>
 #include <qhash.h>
+#include <qshareddata.h>
+#include <qatomic.h>
 
 QT_BEGIN_NAMESPACE
 
@@ -48,7 +50,7 @@ public:
     PROITEM_EXPLICIT ProString(const char *str);
     ProString(const QString &str, int offset, int length);
     void setValue(const QString &str);
-    void clear() { m_string.clear(); m_length = 0; }
+    void clear() { m_string.clear(); m_length = 0; m_atom = 0; }
     ProString &setSource(const ProString &other) { m_file = other.m_file; return *this; }
     ProString &setSource(const ProFile *pro) { m_file = pro; return *this; }
     const ProFile *sourceFile() const { return m_file; }
@@ -66,10 +68,15 @@ public:
     ProString &operator+=(const char *other) { return append(other); }
     ProString &operator+=(QChar other) { return append(other); }
 
-    void chop(int n) { Q_ASSERT(n <= m_length); m_length -= n; }
-    void chopFront(int n) { Q_ASSERT(n <= m_length); m_offset += n; m_length -= n; }
+    void chop(int n) { Q_ASSERT(n <= m_length); m_length -= n; m_atom = 0; }
+    void chopFront(int n) { Q_ASSERT(n <= m_length); m_offset += n; m_length -= n; m_atom = 0; }
 
-    bool operator==(const ProString &other) const { return toQStringRef() == other.toQStringRef(); }
+    bool operator==(const ProString &other) const
+    {
+        if (m_atom && other.m_atom)
+            return m_atom == other.m_atom;
+        return toQStringRef() == other.toQStringRef();
+    }
     bool operator==(const QString &other) const { return toQStringRef() == other; }
     bool operator==(QLatin1String other) const  { return toQStringRef() == other; }
     bool operator==(const char *other) const { return toQStringRef() == QLatin1String(other); }
@@ -139,6 +146,7 @@ private:
     int m_offset, m_length;
     const ProFile *m_file;
     mutable uint m_hash;
+    ushort m_atom; // See ProKey::atom()
     QChar *prepareExtend(int extraLen, int thisTarget, int extraTarget);
     uint updatedHash() const;
     friend uint qHash(const ProString &str);
@@ -154,8 +162,15 @@ public:
     PROITEM_EXPLICIT ProKey(const char *str);
     ProKey(const QString &str, int off, int len);
     ProKey(const QString &str, int off, int len, uint hash);
+    ProKey(const QString &str, int off, int len, uint hash, ushort atom);
     void setValue(const QString &str);
 
+    // Names are interned into a process-wide table on demand. Interned keys compare by their
+    // atom, which also indexes tables of names known in advance, like the builtin functions.
+    // 0 means not interned; this is also the case for all names once the table is full.
+    ushort atom() const { return m_atom; }
+    ushort intern();
+
 #ifdef Q_CC_MSVC
     // Workaround strange MSVC behaviour when exporting classes with ProKey members.
     ALWAYS_INLINE ProKey(const ProKey &other) : ProString(other.toString()) {}
@@ -198,6 +213,9 @@ QTextStream &operator<<(QTextStream &t, const ProString &str);
 
 class ProStringList : public QVector<ProString> {
 public:
+    // Below this many element comparisons, nested linear scans are cheaper than a hash set.
+    enum { HashThreshold = 1024 };
+
     ProStringList() {}
     ProStringList(const ProString &str) { *this << str; }
     explicit ProStringList(const QStringList &list);
@@ -226,7 +244,138 @@ Q_DECLARE_TYPEINFO(ProStringList, Q_MOVABLE_TYPE);
 inline ProStringList operator+(const ProStringList &one, const ProStringList &two)
     { ProStringList ret = one; ret += two; return ret; }
 
-typedef QHash<ProKey, ProStringList> ProValueMap;
+// Maps variable names to their values. This is a hash with open addressing: lookups probe a
+// flat table of hashes and entry indexes, which keeps them within a few cache lines. The
+// entries themselves live in fixed-size blocks which are never moved, so - like with QHash -
+// references to values stay valid while other entries are inserted or removed.
+// The map is implicitly shared.
+class ProValueMap
+{
+    struct Entry
+    {
+        Entry() : used(false) {}
+
+        ProKey key;
+        ProStringList value;
+        bool used;
+    };
+    struct Slot
+    {
+        uint hash;
+        int entry; // Index of the entry, or EmptySlot or RemovedSlot
+    };
+    enum { EmptySlot = -1, RemovedSlot = -2, BlockShift = 5, BlockSize = 1 << BlockShift };
+    struct Data : public QSharedData
+    {
+        Data() : size(0), entryCount(0), removed(0) {}
+        Data(const Data &other);
+        ~Data();
+
+        Entry &entry(int i) const { return blocks.at(i >> BlockShift)[i & (BlockSize - 1)]; }
+        int find(const ProKey &key) const;
+        int insert(const ProKey &key);
+        void erase(int index);
+        void rehash();
+
+        QVector<Entry *> blocks;
+        QVector<Slot> table; // The size is zero or a power of two
+        QVector<int> freeEntries;
+        int size; // Used entries
+        int entryCount; // Used and free entries
+        int removed; // Slots marked RemovedSlot
+    };
+
+public:
+    class ConstIterator;
+
+    class Iterator
+    {
+    public:
+        Iterator() : d(0), i(0) {}
+
+        const ProKey &key() const { return entry().key; }
+        ProStringList &value() const { return entry().value; }
+        ProStringList &operator*() const { return entry().value; }
+        ProStringList *operator->() const { return &entry().value; }
+        Iterator &operator++() { i = next(d, i); return *this; }
+        bool operator==(const Iterator &other) const { return i == other.i; }
+        bool operator!=(const Iterator &other) const { return i != other.i; }
+
+    private:
+        Iterator(Data *data, int index) : d(data), i(index) {}
+        Entry &entry() const { return d->entry(i); }
+
+        Data *d;
+        int i;
+        friend class ProValueMap;
+        friend class ConstIterator;
+    };
+
+    class ConstIterator
+    {
+    public:
+        ConstIterator() : d(0), i(0) {}
+        ConstIterator(const Iterator &other) : d(other.d), i(other.i) {}
+
+        const ProKey &key() const { return entry().key; }
+        const ProStringList &value() const { return entry().value; }
+        const ProStringList &operator*() const { return entry().value; }
+        const ProStringList *operator->() const { return &entry().value; }
+        ConstIterator &operator++() { i = next(d, i); return *this; }
+        bool operator==(const ConstIterator &other) const { return i == other.i; }
+        bool operator!=(const ConstIterator &other) const { return i != other.i; }
+
+    private:
+        ConstIterator(const Data *data, int index) : d(data), i(index) {}
+        const Entry &entry() const { return d->entry(i); }
+
+        const Data *d;
+        int i;
+        friend class ProValueMap;
+    };
+
+    typedef Iterator iterator;
+    typedef ConstIterator const_iterator;
+
+    ProValueMap();
+    ProValueMap(const ProValueMap &other);
+    ~ProValueMap();
+    ProValueMap &operator=(const ProValueMap &other);
+
+    int size() const;
+    int count() const { return size(); }
+    bool isEmpty() const { return !size(); }
+    void clear();
+
+    bool contains(const ProKey &key) const { return lookup(key) >= 0; }
+    ProStringList value(const ProKey &key) const;
+    ProStringList &operator[](const ProKey &key);
+    Iterator insert(const ProKey &key, const ProStringList &value);
+    int remove(const ProKey &key);
+    Iterator erase(Iterator it);
+
+    Iterator find(const ProKey &key);
+    ConstIterator find(const ProKey &key) const { return constFind(key); }
+    ConstIterator constFind(const ProKey &key) const;
+
+    Iterator begin();
+    Iterator end();
+    ConstIterator begin() const { return constBegin(); }
+    ConstIterator end() const { return constEnd(); }
+    ConstIterator constBegin() const;
+    ConstIterator constEnd() const;
+
+private:
+    static int next(const Data *d, int i)
+    {
+        while (++i < d->entryCount && !d->entry(i).used) {}
+        return i;
+    }
+    int lookup(const ProKey &key) const { return d ? d->find(key) : -1; }
+    Data *detached();
+
+    QSharedDataPointer<Data> d;
+};
 
 // These token definitions affect both ProFileEvaluator and ProWriter
 enum ProToken {
@@ -248,14 +397,17 @@ enum ProToken {
                         // - hash (2)
                         // - length (1)
                         // - string data (length; unterminated)
+                        // - atom (1; 0 until the evaluator interns the string)
     TokVariable,        // qmake variable expansion
                         // - hash (2)
                         // - name length (1)
                         // - name (name length; unterminated)
+                        // - atom (1)
     TokProperty,        // qmake property expansion
                         // - hash (2)
                         // - name length (1)
                         // - name (name length; unterminated)
+                        // - atom (1)
     TokEnvVar,          // environment variable expansion
                         // - name length (1)
                         // - name (name length; unterminated)
@@ -263,6 +415,7 @@ enum ProToken {
                         // - hash (2)
                         // - name length (1)
                         // - name (name length; unterminated)
+                        // - atom (1)
                         // - ((nested expansion + TokArgSeparator)* + nested expansion)?
                         // - TokFuncTerminator
     TokArgSeparator,    // function argument separator
@@ -283,13 +436,13 @@ enum ProToken {
                         // - else block length (2)
                         // - else block + TokTerminator (else block length)
     TokForLoop,         // for loop:
-                        // - variable name: hash (2), length (1), chars (length)
+                        // - variable name: hash (2), length (1), chars (length), atom (1)
                         // - expression: length (2), bytes + TokValueTerminator (length)
                         // - body length (2)
                         // - body + TokTerminator (body length)
     TokTestDef,         // test function definition:
     TokReplaceDef,      // replace function definition:
-                        // - function name: hash (2), length (1), chars (length)
+                        // - function name: hash (2), length (1), chars (length), atom (1)
                         // - body length (2)
                         // - body + TokTerminator (body length)
     TokMask = 0xff,
@@ -297,6 +450,41 @@ enum ProToken {
     TokNewStr = 0x200   // Next stringlist element
 };
 
+// One instruction of a ProCode. tok is the token it was lowered from, including its flags.
+struct ProCodeInstr
+{
+    ushort tok;
+    int a, b; // Pre-decoded operands, see ProCode
+    int next; // Index of the instruction following the operands and nested expressions of tok
+};
+Q_DECLARE_TYPEINFO(ProCodeInstr, Q_PRIMITIVE_TYPE);
+
+// A token stream lowered for repeated evaluation. There is one instruction per token. Strings
+// are decoded into constant pools, variable names are mapped, builtin functions are resolved
+// and nested blocks are referenced by instruction index:
+//   TokLine                       a = line
+//   TokAssign .. TokReplace       a = size hint; value and TokValueTerminator follow
+//   TokLiteral, TokEnvVar         a = index in strings
+//   TokHashLiteral, TokProperty   a = index in keys
+//   TokVariable                   a = name in keys, b = a, or -1 if the name is deprecated
+//   TokFuncName                   a = name in keys, b = builtin expand or 0; arguments follow
+//   TokTestCall                   a = literal name in keys or -1, b = builtin test or 0;
+//                                 arguments follow
+//   TokBranch                     a, b = first instruction of the then/else block or -1
+//   TokForLoop                    a = variable in keys or -1, b = token offset of the body;
+//                                 expression and TokValueTerminator follow
+//   TokTestDef, TokReplaceDef     a = name in keys, b = token offset of the body
+// Blocks end with TokTerminator.
+// Variables are not resolved to slots: the value maps are keyed by interned ProKeys already,
+// and functions and builtins create variables by name at run time.
+struct ProCode
+{
+    QVector<ProCodeInstr> instrs;
+    QVector<ProString> strings;
+    QVector<ProKey> keys;
+    QHash<int, int> entries; // Token offset of each block => index of its first instruction
+};
+
 class QMAKE_EXPORT ProFile
 {
 public:
@@ -318,8 +506,18 @@ public:
     bool isHostBuild() const { return m_hostBuild; }
     void setHostBuild(bool host_build) { m_hostBuild = host_build; }
 
+    // The lowered token stream, see QMakeEvaluator::compiledCode(). Concurrent evaluations may
+    // compile the same file; the first code stored is kept and returned by setCode().
+    const ProCode *code() const { return m_code.loadAcquire(); }
+    const ProCode *setCode(ProCode *code);
+    // Counts the evaluations of the file and of the functions it defines.
+    void noteVisit() { m_visits.ref(); }
+    int visits() const { return m_visits.load(); }
+
 private:
     ProItemRefCount m_refCount;
+    QAtomicPointer<ProCode> m_code;
+    QAtomicInt m_visits;
     QString m_proitems;
     QString m_fileName;
     QString m_directoryName;
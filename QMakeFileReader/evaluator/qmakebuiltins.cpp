@@ -11,6 +11,8 @@
 #include "ioutils.h"
 
 #include <qbytearray.h>
+#include <qcache.h>
+#include <qcryptographichash.h>
 #include <qdir.h>
 #include <qfile.h>
 #include <qfileinfo.h>
@@ -19,6 +21,9 @@
 #include <qset.h>
 #include <qstringlist.h>
 #include <qtextstream.h>
+#ifdef PROEVALUATOR_THREAD_SAFE
+# include <qthreadpool.h>
+#endif
 
 #ifdef Q_OS_UNIX
 #include <time.h>
@@ -111,8 +116,15 @@ void QMakeEvaluator::initFunctionStatics()
         { "system_quote", E_SYSTEM_QUOTE },
         { "shell_quote", E_SHELL_QUOTE },
     };
-    for (unsigned i = 0; i < sizeof(expandInits)/sizeof(expandInits[0]); ++i)
-        statics.expands.insert(ProKey(expandInits[i].name), expandInits[i].func);
+    for (unsigned i = 0; i < sizeof(expandInits)/sizeof(expandInits[0]); ++i) {
+        ProKey name(expandInits[i].name);
+        statics.expands.insert(name, expandInits[i].func);
+        if (ushort atom = name.intern()) {
+            if (atom >= statics.expandsByAtom.size())
+                statics.expandsByAtom.resize(atom + 1);
+            statics.expandsByAtom[atom] = expandInits[i].func;
+        }
+    }
 
     static const struct {
         const char * const name;
@@ -149,8 +161,15 @@ void QMakeEvaluator::initFunctionStatics()
         { "touch", T_TOUCH },
         { "cache", T_CACHE },
     };
-    for (unsigned i = 0; i < sizeof(testInits)/sizeof(testInits[0]); ++i)
-        statics.functions.insert(ProKey(testInits[i].name), testInits[i].func);
+    for (unsigned i = 0; i < sizeof(testInits)/sizeof(testInits[0]); ++i) {
+        ProKey name(testInits[i].name);
+        statics.functions.insert(name, testInits[i].func);
+        if (ushort atom = name.intern()) {
+            if (atom >= statics.functionsByAtom.size())
+                statics.functionsByAtom.resize(atom + 1);
+            statics.functionsByAtom[atom] = testInits[i].func;
+        }
+    }
 }
 
 static bool isTrue(const ProString &_str, QString &tmp)
@@ -159,6 +178,94 @@ static bool isTrue(const ProString &_str, QString &tmp)
     return !str.compare(statics.strtrue, Qt::CaseInsensitive) || str.toInt();
 }
 
+namespace {
+
+// A call of a builtin replace function whose result only depends on the values in the key.
+struct MemoKey
+{
+    int func; // 0 if the call is not memoized
+    QString context; // The directory or separator the function depends on, if any
+    ProStringList inputs; // The arguments, or the values of the variable named by them
+};
+
+uint qHash(const MemoKey &key)
+{
+    uint hash = uint(key.func) ^ qHash(key.context);
+    foreach (const ProString &input, key.inputs)
+        hash = hash * 31 + qHash(input);
+    return hash;
+}
+
+bool operator==(const MemoKey &one, const MemoKey &two)
+{
+    return one.func == two.func && one.context == two.context && one.inputs == two.inputs;
+}
+
+// Feature files apply the same path and string functions to the same values in every project.
+struct ExpandMemo
+{
+    ExpandMemo() : results(4096), hits(0), misses(0) {}
+
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutex mutex;
+#endif
+    QCache<MemoKey, ProStringList> results; // Least recently used ones are dropped first
+    qint64 hits, misses;
+};
+
+}
+
+Q_GLOBAL_STATIC(ExpandMemo, expandMemo)
+
+// Element i of the results is derived from input i, so it takes its source from there.
+static bool lookupMemo(const MemoKey &key, ProStringList *ret)
+{
+    ExpandMemo *memo = expandMemo();
+    {
+#ifdef PROEVALUATOR_THREAD_SAFE
+        QMutexLocker locker(&memo->mutex);
+#endif
+        const ProStringList *results = memo->results.object(key);
+        if (!results) {
+            ++memo->misses;
+            return false;
+        }
+        ++memo->hits;
+        *ret = *results;
+    }
+    for (int i = 0; i < ret->size() && i < key.inputs.size(); ++i)
+        (*ret)[i].setSource(key.inputs.at(i));
+    return true;
+}
+
+static void storeMemo(const MemoKey &key, const ProStringList &results)
+{
+    // Deep copies, so that the memo does not keep the contents of project files alive.
+    MemoKey copy = { key.func, key.context, ProStringList() };
+    copy.inputs.reserve(key.inputs.size());
+    foreach (const ProString &input, key.inputs)
+        copy.inputs << ProString(input.toQString());
+    ProStringList *copied = new ProStringList;
+    copied->reserve(results.size());
+    foreach (const ProString &result, results)
+        *copied << ProString(result.toQString());
+    ExpandMemo *memo = expandMemo();
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&memo->mutex);
+#endif
+    memo->results.insert(copy, copied);
+}
+
+void QMakeEvaluator::expandMemoStats(qint64 *hits, qint64 *misses)
+{
+    ExpandMemo *memo = expandMemo();
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&memo->mutex);
+#endif
+    *hits = memo->hits;
+    *misses = memo->misses;
+}
+
 #ifdef Q_OS_WIN
 static QString windowsErrorCode()
 {
@@ -285,34 +392,128 @@ QMakeEvaluator::writeFile(const QString &ctx, const QString &fn, QIODevice::Open
         return ReturnFalse;
     }
     m_parser->discardFileFromCache(qfi.filePath());
+    fileTypeCache()->clear();
     return ReturnTrue;
 }
 
 #ifndef QT_BOOTSTRAPPED
 void QMakeEvaluator::runProcess(QProcess *proc, const QString &command) const
 {
-    proc->setWorkingDirectory(currentDirectory());
+    runProcess(proc, command, currentDirectory(), m_option);
+    // The command may have created or removed files.
+    fileTypeCache()->clear();
+}
+
+void QMakeEvaluator::runProcess(QProcess *proc, const QString &command, const QString &dir,
+                                const QMakeGlobals *option)
+{
+    proc->setWorkingDirectory(dir);
 # ifdef PROEVALUATOR_SETENV
-    if (!m_option->environment.isEmpty())
-        proc->setProcessEnvironment(m_option->environment);
+    if (!option->environment.isEmpty())
+        proc->setProcessEnvironment(option->environment);
 # endif
 # ifdef Q_OS_WIN
     proc->setNativeArguments(QLatin1String("/v:off /s /c \"") + command + QLatin1Char('"'));
-    proc->start(m_option->getEnv(QLatin1String("COMSPEC")), QStringList());
+    proc->start(option->getEnv(QLatin1String("COMSPEC")), QStringList());
 # else
     proc->start(QLatin1String("/bin/sh"), QStringList() << QLatin1String("-c") << command);
 # endif
     proc->waitForFinished(-1);
 }
+
+static QString environmentDigest(const QProcessEnvironment &environment)
+{
+    QStringList variables = environment.toStringList();
+    variables.sort();
+    return QString::fromLatin1(QCryptographicHash::hash(
+            variables.join(QLatin1Char('\n')).toUtf8(), QCryptographicHash::Sha1).toHex());
+}
+
+// Everything the output of a command depends on, besides the state of the file system.
+QString QMakeEvaluator::commandKey(const QString &command, const QString &dir,
+                                   const QMakeGlobals *option)
+{
+    static const QString systemEnvironment =
+            environmentDigest(QProcessEnvironment::systemEnvironment());
+    QString environment = systemEnvironment;
+# ifdef PROEVALUATOR_SETENV
+    if (!option->environment.isEmpty())
+        environment = environmentDigest(option->environment);
+# else
+    Q_UNUSED(option);
+# endif
+    return command + QLatin1Char('\n') + dir + QLatin1Char('\n') + environment;
+}
+
+static QMakeCommandOutput readCommandOutput(QProcess *proc)
+{
+    QMakeCommandOutput output;
+    output.err = proc->readAllStandardError();
+    output.out = proc->readAllStandardOutput();
+# ifdef Q_OS_WIN
+    // FIXME: Qt's line end conversion on sequential files should really be fixed
+    output.out.replace("\r\n", "\n");
+# endif
+    return output;
+}
+
+# ifdef PROEVALUATOR_THREAD_SAFE
+namespace {
+
+class CommandPrefetch : public QRunnable
+{
+public:
+    CommandPrefetch(const QString &command, const QString &dir, const QString &key,
+                    QMakeGlobals *option)
+        : m_command(command), m_dir(dir), m_key(key), m_option(option) {}
+
+    void run()
+    {
+        QProcess proc;
+        QMakeEvaluator::runProcess(&proc, m_command, m_dir, m_option);
+        QMakeCommandOutput output = readCommandOutput(&proc);
+        output.prefetched = true;
+        m_option->storeCommandOutput(m_key, output);
+    }
+
+private:
+    QString m_command, m_dir, m_key;
+    QMakeGlobals *m_option;
+};
+
+}
+
+// Commands are assumed to be queries (see qmakedemand.cpp), so running the ones of branches
+// which are not taken is merely wasted work.
+void QMakeEvaluator::prefetchCommands(ProFile *pro)
+{
+    const QString dir = pro->directoryName();
+    foreach (const QString &command, literalCommands(pro)) {
+        const QString key = commandKey(command, dir, m_option);
+        if (m_option->claimCommandOutput(key, 0))
+            m_option->commandPool.start(new CommandPrefetch(command, dir, key, m_option));
+    }
+}
+# endif
 #endif
 
 QByteArray QMakeEvaluator::getCommandOutput(const QString &args) const
 {
     QByteArray out;
+    dependsOn(QMakeHandler::DependVolatile, args);
 #ifndef QT_BOOTSTRAPPED
-    QProcess proc;
-    runProcess(&proc, args);
-    QByteArray errout = proc.readAllStandardError();
+    const QString key = commandKey(args, currentDirectory(), m_option);
+    QMakeCommandOutput output;
+    if (m_option->claimCommandOutput(key, &output)) {
+        QProcess proc;
+        runProcess(&proc, args);
+        output = readCommandOutput(&proc);
+        m_option->storeCommandOutput(key, output);
+    } else if (output.prefetched) {
+        // The command may have created or removed files.
+        fileTypeCache()->clear();
+    }
+    QByteArray errout = output.err;
 # ifdef PROEVALUATOR_FULL
     // FIXME: Qt really should have the option to set forwarding per channel
     fputs(errout.constData(), stderr);
@@ -323,11 +524,7 @@ QByteArray QMakeEvaluator::getCommandOutput(const QString &args) const
         m_handler->message(QMakeHandler::EvalError, QString::fromLocal8Bit(errout));
     }
 # endif
-    out = proc.readAllStandardOutput();
-# ifdef Q_OS_WIN
-    // FIXME: Qt's line end conversion on sequential files should really be fixed
-    out.replace("\r\n", "\n");
-# endif
+    out = output.out;
 #else
     if (FILE *proc = QT_POPEN(QString(QLatin1String("cd ")
                                + IoUtils::shellQuote(QDir::toNativeSeparators(currentDirectory()))
@@ -373,6 +570,45 @@ ProStringList QMakeEvaluator::evaluateBuiltinExpand(
 
     traceMsg("calling built-in $$%s(%s)", dbgKey(func), dbgSepStrList(args));
 
+    MemoKey memoKey = { 0, QString(), ProStringList() };
+    switch (func_t) {
+    case E_BASENAME:
+    case E_DIRNAME:
+        if (args.count() == 1 && !args.at(0).isEmpty()) {
+            memoKey.func = func_t;
+            memoKey.inputs = values(map(args.at(0)));
+        }
+        break;
+    case E_UPPER:
+    case E_LOWER:
+    case E_RE_ESCAPE:
+        memoKey.func = func_t;
+        memoKey.inputs = args;
+        break;
+    case E_ABSOLUTE_PATH:
+    case E_RELATIVE_PATH:
+        if (args.count() <= 2) {
+            memoKey.func = func_t;
+            if (args.count() == 1)
+                memoKey.context = currentDirectory();
+            memoKey.inputs = args;
+        }
+        break;
+    case E_SHELL_PATH:
+        if (args.count() == 1)
+            memoKey.context = m_dirSep.toQString();
+        // fallthrough
+    case E_CLEAN_PATH:
+    case E_SYSTEM_PATH:
+        if (args.count() == 1) {
+            memoKey.func = func_t;
+            memoKey.inputs = args;
+        }
+        break;
+    }
+    if (memoKey.func && lookupMemo(memoKey, &ret))
+        return ret;
+
     switch (func_t) {
     case E_BASENAME:
     case E_DIRNAME:
@@ -408,8 +644,9 @@ ProStringList QMakeEvaluator::evaluateBuiltinExpand(
         }
         if (!var.isEmpty()) {
             if (regexp) {
-                QRegExp sepRx(sep);
-                foreach (const ProString &str, values(map(var))) {
+                const QRegExp sepRx = compiledPattern(sep);
+                // basename() and dirname() have looked up the values for the memo already.
+                foreach (const ProString &str, memoKey.func ? memoKey.inputs : values(map(var))) {
                     const QString &rstr = str.toQString(m_tmp1).section(sepRx, beg, end);
                     ret << (rstr.isSharedWith(m_tmp1) ? str : ProString(rstr).setSource(str));
                 }
@@ -625,7 +862,7 @@ ProStringList QMakeEvaluator::evaluateBuiltinExpand(
                     lines = true;
             }
 
-            QFile qfile(resolvePath(m_option->expandEnvVars(file)));
+            QFile qfile(resolvePath(expandEnvVars(file)));
             if (qfile.open(QIODevice::ReadOnly)) {
                 QTextStream stream(&qfile);
                 if (blob) {
@@ -649,7 +886,7 @@ ProStringList QMakeEvaluator::evaluateBuiltinExpand(
             evalError(fL1S("fromfile(file, variable) requires two arguments."));
         } else {
             ProValueMap vars;
-            QString fn = resolvePath(m_option->expandEnvVars(args.at(0).toQString(m_tmp1)));
+            QString fn = resolvePath(expandEnvVars(args.at(0).toQString(m_tmp1)));
             fn.detach();
             if (evaluateFileInto(fn, &vars, LoadProOnly) == ReturnTrue)
                 ret = vars.value(map(args.at(1)));
@@ -675,7 +912,7 @@ ProStringList QMakeEvaluator::evaluateBuiltinExpand(
         if (args.count() != 2) {
             evalError(fL1S("find(var, str) requires two arguments."));
         } else {
-            QRegExp regx(args.at(1).toQString());
+            const QRegExp regx = compiledPattern(args.at(1).toQString(m_tmp3));
             int t = 0;
             foreach (const ProString &val, values(map(args.at(0)))) {
                 if (regx.indexIn(val.toQString(m_tmp[t])) != -1)
@@ -806,7 +1043,7 @@ ProStringList QMakeEvaluator::evaluateBuiltinExpand(
             if (args.count() == 2)
                 recursive = isTrue(args.at(1), m_tmp2);
             QStringList dirs;
-            QString r = m_option->expandEnvVars(args.at(0).toQString(m_tmp1))
+            QString r = expandEnvVars(args.at(0).toQString(m_tmp1))
                         .replace(QLatin1Char('\\'), QLatin1Char('/'));
             QString pfx;
             if (IoUtils::isRelativePath(r)) {
@@ -822,20 +1059,24 @@ ProStringList QMakeEvaluator::evaluateBuiltinExpand(
                 dirs.append(QString());
             }
 
-            r.detach(); // Keep m_tmp out of QRegExp's cache
-            QRegExp regex(r, Qt::CaseSensitive, QRegExp::Wildcard);
+            const QRegExp regex = compiledPattern(r, QRegExp::Wildcard);
+            FileTypeCache *fileTypes = fileTypeCache();
+#ifdef PROEVALUATOR_THREAD_SAFE
+            if (recursive)
+                fileTypes->prefetchTree(pfx + dirs.first());
+#endif
             for (int d = 0; d < dirs.count(); d++) {
                 QString dir = dirs[d];
-                QDir qdir(pfx + dir);
-                for (int i = 0; i < (int)qdir.count(); ++i) {
-                    if (qdir[i] == statics.strDot || qdir[i] == statics.strDotDot)
-                        continue;
-                    QString fname = dir + qdir[i];
-                    if (IoUtils::fileType(pfx + fname) == IoUtils::FileIsDir) {
+                dependsOn(QMakeHandler::DependDirectoryContents, pfx + dir);
+                const QVector<IoUtils::DirEntry> entries = fileTypes->directoryEntries(pfx + dir);
+                for (int i = 0; i < entries.size(); ++i) {
+                    const IoUtils::DirEntry &entry = entries.at(i);
+                    QString fname = dir + entry.name;
+                    if (entry.type == IoUtils::FileIsDir) {
                         if (recursive)
                             dirs.append(fname + QLatin1Char('/'));
                     }
-                    if (regex.exactMatch(qdir[i]))
+                    if (regex.exactMatch(entry.name))
                         ret += ProString(fname).setSource(currentProFile());
                 }
             }
@@ -848,7 +1089,8 @@ ProStringList QMakeEvaluator::evaluateBuiltinExpand(
 //        } else if (currentFileName() == QLatin1String("-")) {
 //            evalError(fL1S("prompt(question) cannot be used when '-o -' is used"));
         } else {
-            QString msg = m_option->expandEnvVars(args.at(0).toQString(m_tmp1));
+            dependsOn(QMakeHandler::DependVolatile, fL1S("prompt()"));
+            QString msg = expandEnvVars(args.at(0).toQString(m_tmp1));
             if (!msg.endsWith(QLatin1Char('?')))
                 msg += QLatin1Char('?');
             fprintf(stderr, "Project PROMPT: %s ", qPrintable(msg));
@@ -865,7 +1107,7 @@ ProStringList QMakeEvaluator::evaluateBuiltinExpand(
         if (args.count() != 3 ) {
             evalError(fL1S("replace(var, before, after) requires three arguments."));
         } else {
-            const QRegExp before(args.at(1).toQString());
+            const QRegExp before = compiledPattern(args.at(1).toQString(m_tmp3));
             const QString &after(args.at(2).toQString(m_tmp2));
             foreach (const ProString &val, values(map(args.at(0)))) {
                 QString rstr = val.toQString(m_tmp1);
@@ -900,10 +1142,14 @@ ProStringList QMakeEvaluator::evaluateBuiltinExpand(
         }
         break;
     case E_ENUMERATE_VARS: {
+        if (m_demand)
+            noteVariableRead(ProKey()); // Observes all variables
         QSet<ProString> keys;
-        foreach (const ProValueMap &vmap, m_valuemapStack)
+        for (int i = 0; i < m_valuemapStack.size(); ++i) {
+            const ProValueMap &vmap = m_valuemapStack.frame(i);
             for (ProValueMap::ConstIterator it = vmap.constBegin(); it != vmap.constEnd(); ++it)
                 keys.insert(it.key());
+        }
         ret.reserve(keys.size());
         foreach (const ProString &key, keys)
             ret << key;
@@ -996,6 +1242,8 @@ ProStringList QMakeEvaluator::evaluateBuiltinExpand(
         break;
     }
 
+    if (memoKey.func)
+        storeMemo(memoKey, ret);
     return ret;
 }
 
@@ -1047,6 +1295,7 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateBuiltinConditional(
                 (*vmi).erase(it);
                 while (--vmi != m_valuemapStack.begin())
                     (*vmi).remove(var);
+                invalidateScopeCache();
                 break;
             }
         }
@@ -1057,7 +1306,7 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateBuiltinConditional(
             evalError(fL1S("infile(file, var, [values]) requires two or three arguments."));
         } else {
             ProValueMap vars;
-            QString fn = resolvePath(m_option->expandEnvVars(args.at(0).toQString(m_tmp1)));
+            QString fn = resolvePath(expandEnvVars(args.at(0).toQString(m_tmp1)));
             fn.detach();
             VisitReturn ok = evaluateFileInto(fn, &vars, LoadProOnly);
             if (ok != ReturnTrue)
@@ -1066,11 +1315,8 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateBuiltinConditional(
                 return returnBool(vars.contains(map(args.at(1))));
             QRegExp regx;
             const QString &qry = args.at(2).toQString(m_tmp1);
-            if (qry != QRegExp::escape(qry)) {
-                QString copy = qry;
-                copy.detach();
-                regx.setPattern(copy);
-            }
+            if (qry != QRegExp::escape(qry))
+                regx = compiledPattern(qry);
             int t = 0;
             foreach (const ProString &s, vars.value(map(args.at(1)))) {
                 if ((!regx.isEmpty() && regx.exactMatch(s.toQString(m_tmp[t]))) || s == qry)
@@ -1115,16 +1361,8 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateBuiltinConditional(
         if (args.count() == 1)
             return returnBool(isActiveConfig(args.at(0).toQString(m_tmp2)));
         const QStringList &mutuals = args.at(1).toQString(m_tmp2).split(QLatin1Char('|'));
-        const ProStringList &configs = values(statics.strCONFIG);
-
-        for (int i = configs.size() - 1; i >= 0; i--) {
-            for (int mut = 0; mut < mutuals.count(); mut++) {
-                if (configs[i] == mutuals[mut].trimmed()) {
-                    return returnBool(configs[i] == args[0]);
-                }
-            }
-        }
-        return ReturnFalse;
+        const int mut = lastActiveConfig(mutuals);
+        return returnBool(mut >= 0 && mutuals.at(mut).trimmed() == args.at(0));
     }
     case T_CONTAINS: {
         if (args.count() < 2 || args.count() > 3) {
@@ -1134,12 +1372,17 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateBuiltinConditional(
 
         const QString &qry = args.at(1).toQString(m_tmp1);
         QRegExp regx;
-        if (qry != QRegExp::escape(qry)) {
-            QString copy = qry;
-            copy.detach();
-            regx.setPattern(copy);
+        if (qry != QRegExp::escape(qry))
+            regx = compiledPattern(qry);
+        const ProKey &var = map(args.at(0));
+        if (var == statics.strCONFIG && regx.isEmpty()) {
+            if (args.count() == 2)
+                return returnBool(configIndex().lastPosition.contains(args.at(1)));
+            const QStringList &mutuals = args.at(2).toQString(m_tmp3).split(QLatin1Char('|'));
+            const int mut = lastActiveConfig(mutuals);
+            return returnBool(mut >= 0 && mutuals.at(mut).trimmed() == qry);
         }
-        const ProStringList &l = values(map(args.at(0)));
+        const ProStringList &l = values(var);
         if (args.count() == 2) {
             int t = 0;
             for (int i = 0; i < l.size(); ++i) {
@@ -1269,7 +1512,7 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateBuiltinConditional(
             if (args.count() >= 3 && isTrue(args.at(2), m_tmp3))
                 flags = LoadSilent;
         }
-        QString fn = resolvePath(m_option->expandEnvVars(args.at(0).toQString(m_tmp1)));
+        QString fn = resolvePath(expandEnvVars(args.at(0).toQString(m_tmp1)));
         fn.detach();
         VisitReturn ok;
         if (parseInto.isEmpty()) {
@@ -1309,7 +1552,7 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateBuiltinConditional(
             evalError(fL1S("load(feature) requires one or two arguments."));
             return ReturnFalse;
         }
-        VisitReturn ok = evaluateFeatureFile(m_option->expandEnvVars(args.at(0).toQString()),
+        VisitReturn ok = evaluateFeatureFile(expandEnvVars(args.at(0).toQString()),
                                              ignore_error);
         if (ok == ReturnFalse && ignore_error)
             ok = ReturnTrue;
@@ -1323,7 +1566,7 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateBuiltinConditional(
         }
         int level = args.at(0).toInt();
         if (level <= m_debugLevel) {
-            const QString &msg = m_option->expandEnvVars(args.at(1).toQString(m_tmp2));
+            const QString &msg = expandEnvVars(args.at(1).toQString(m_tmp2));
             debugMsg(level, "Project DEBUG: %s", qPrintable(msg));
         }
 #endif
@@ -1338,7 +1581,7 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateBuiltinConditional(
                       .arg(function.toQString(m_tmp1)));
             return ReturnFalse;
         }
-        const QString &msg = m_option->expandEnvVars(args.at(0).toQString(m_tmp2));
+        const QString &msg = expandEnvVars(args.at(0).toQString(m_tmp2));
         if (!m_skipLevel) {
             if (func_t == T_LOG) {
 #ifdef PROEVALUATOR_FULL
@@ -1383,15 +1626,17 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateBuiltinConditional(
             evalError(fL1S("exists(file) requires one argument."));
             return ReturnFalse;
         }
-        const QString &file = resolvePath(m_option->expandEnvVars(args.at(0).toQString(m_tmp1)));
+        const QString &file = resolvePath(expandEnvVars(args.at(0).toQString(m_tmp1)));
 
-        if (IoUtils::exists(file)) {
+        dependsOn(QMakeHandler::DependFileExistence, file);
+        if (exists(file)) {
             return ReturnTrue;
         }
         int slsh = file.lastIndexOf(QLatin1Char('/'));
         QString fn = file.mid(slsh+1);
         if (fn.contains(QLatin1Char('*')) || fn.contains(QLatin1Char('?'))) {
             QString dirstr = file.left(slsh+1);
+            dependsOn(QMakeHandler::DependDirectoryContents, dirstr);
             if (!QDir(dirstr).entryList(QStringList(fn)).isEmpty())
                 return ReturnTrue;
         }
@@ -1409,6 +1654,7 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateBuiltinConditional(
             evalError(fL1S("Cannot create directory %1.").arg(QDir::toNativeSeparators(fn)));
             return ReturnFalse;
         }
+        fileTypeCache()->clear();
         return ReturnTrue;
     }
     case T_WRITE_FILE: {
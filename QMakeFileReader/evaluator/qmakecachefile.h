@@ -0,0 +1,55 @@
+/***************************************************************************************************
+ Copyright (C) 2024 The Qt Company Ltd.
+ SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only WITH Qt-GPL-exception-1.0
+***************************************************************************************************/
+
+#ifndef QMAKECACHEFILE_H
+#define QMAKECACHEFILE_H
+
+#include <qcryptographichash.h>
+#include <qdatastream.h>
+#include <qstring.h>
+
+QT_BEGIN_NAMESPACE
+
+namespace QMakeInternal {
+
+/*
+  The files of the on-disk caches start with a magic number, a version and the key they were
+  written for. A cache must bump its version whenever the layout of its files changes; files
+  with a different magic number, version or key are ignored.
+*/
+
+inline QString cacheFileName(const QString &dir, const QString &key, const char *suffix)
+{
+    return dir + QLatin1Char('/')
+            + QString::fromLatin1(QCryptographicHash::hash(key.toUtf8(),
+                                                           QCryptographicHash::Sha1).toHex())
+            + QLatin1String(suffix);
+}
+
+inline void writeCacheHeader(QDataStream &stream, quint32 magic, quint32 version,
+                             const QString &key)
+{
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << magic << version << key;
+}
+
+inline bool readCacheHeader(QDataStream &stream, quint32 magic, quint32 version,
+                            const QString &key)
+{
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint32 storedMagic, storedVersion;
+    stream >> storedMagic >> storedVersion;
+    if (stream.status() != QDataStream::Ok || storedMagic != magic || storedVersion != version)
+        return false;
+    QString storedKey;
+    stream >> storedKey;
+    return stream.status() == QDataStream::Ok && storedKey == key;
+}
+
+} // namespace QMakeInternal
+
+QT_END_NAMESPACE
+
+#endif // QMAKECACHEFILE_H
@@ -0,0 +1,514 @@
+/***************************************************************************************************
+ Copyright (C) 2024 The Qt Company Ltd.
+ SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only WITH Qt-GPL-exception-1.0
+***************************************************************************************************/
+
+#include "qmakeevaluator.h"
+
+#include "qmakeevaluator_p.h"
+
+#include <qhash.h>
+#include <qset.h>
+#include <qvector.h>
+
+using namespace QMakeInternal;
+
+QT_BEGIN_NAMESPACE
+
+///////////////////////////////////////////////////////////////////////
+//
+// Demand-driven evaluation
+//
+///////////////////////////////////////////////////////////////////////
+
+// Before a token stream is visited for the first time, it is scanned for the names each
+// variable may derive its value from: the variables and literals in the assigned values, and
+// in the conditions around the assignment. A variable is relevant if it is a target, if it is
+// read by the evaluator itself, or if a relevant variable may derive from it. Names used in
+// any other way (e.g. include() arguments, loop lists, function bodies) are relevant from the
+// start.
+//
+// The analysis also records the statements which do nothing but assign variables: unconditional
+// assignments, and branches whose conditions and blocks only assign variables and call builtins
+// without side effects on the evaluation. Such a statement is skipped if none of the variables
+// it assigns is relevant at the time it is reached. Commands run by system() are assumed to be
+// queries, so they are skipped along with the statement.
+//
+// The set of relevant variables grows as further files are loaded, so the prediction may turn
+// out wrong. To stay correct regardless, the evaluator notes any read of a skipped variable. If
+// there was one, skippedVariablesRead() tells the caller to evaluate again without targets.
+
+struct QMakeEvaluator::DemandState
+{
+    DemandState() : skippedRead(false) {}
+    ~DemandState()
+    {
+        foreach (ProFile *pro, files.keys())
+            pro->deref();
+    }
+
+    // A statement which only assigns variables.
+    struct Statement
+    {
+        Statement() : end(0), branch(false) {}
+
+        int end; // Offset of the token following the statement
+        bool branch; // The statement ends with a branch
+        QVector<ProKey> assigned;
+    };
+    typedef QHash<int, Statement> Statements; // By offset of the first token
+
+    bool isRelevant(const ProKey &name) const
+    {
+        if (relevant.contains(name))
+            return true;
+        foreach (const QString &suffix, relevantSuffixes) {
+            if (name.toQStringRef().endsWith(suffix))
+                return true;
+        }
+        return false;
+    }
+
+    void markRelevant(const ProKey &name)
+    {
+        QVector<ProKey> pending;
+        pending << name;
+        while (!pending.isEmpty()) {
+            const ProKey next = pending.takeLast();
+            if (relevant.contains(next))
+                continue;
+            relevant.insert(next);
+            foreach (const ProKey &source, sources.take(next))
+                pending << source;
+        }
+    }
+
+    void addSources(const ProKey &variable, const QSet<ProKey> &names)
+    {
+        if (isRelevant(variable)) {
+            foreach (const ProKey &name, names)
+                markRelevant(name);
+        } else {
+            sources[variable] += names;
+        }
+    }
+
+    QHash<ProFile *, Statements> files; // Analyzed token streams, referenced
+    QHash<ProKey, QSet<ProKey> > sources; // Of variables which are not relevant (yet)
+    QSet<ProKey> relevant;
+    QStringList relevantSuffixes;
+    QSet<ProKey> skipped; // Variables assigned by skipped statements
+    bool skippedRead;
+};
+
+namespace {
+
+// Test functions which only compute their result.
+const char * const pureTests[] = {
+    "greaterThan", "lessThan", "equals", "isEqual", "exists", "CONFIG", "isActiveConfig",
+    "system", "defined", "contains", "infile", "count", "isEmpty", "debug", "log", "message",
+    "warning"
+};
+
+// Replace functions which observe more than the variables named in their arguments.
+const char * const impureExpands[] = { "enumerate_vars", "prompt" };
+
+// Variables which the evaluator reads by itself.
+const char * const evaluatorVariables[] = {
+    "CONFIG", "TEMPLATE", "QMAKE_PLATFORM", "QMAKESPEC", "XQMAKESPEC", "QMAKEPATH",
+    "QMAKEFEATURES", "QMAKE_DIR_SEP", "REQUIRES", "QMAKE_FAILED_REQUIREMENTS",
+    "QMAKE_INTERNAL_INCLUDED_FILES", "QMAKE_INTERNAL_INCLUDED_FEATURES"
+};
+
+// The evaluator's own token helpers are inlined into its translation unit.
+inline uint blockLen(const ushort *&tokPtr)
+{
+    uint len = *tokPtr++;
+    len |= (uint)*tokPtr++ << 16;
+    return len;
+}
+
+inline void skipStr(const ushort *&tokPtr)
+{
+    uint len = *tokPtr++;
+    tokPtr += len;
+}
+
+inline void skipHashStr(const ushort *&tokPtr)
+{
+    tokPtr += 2;
+    uint len = *tokPtr++;
+    tokPtr += len + 1;
+}
+
+struct FunctionSets
+{
+    FunctionSets()
+    {
+        for (unsigned i = 0; i < sizeof(pureTests) / sizeof(pureTests[0]); ++i)
+            pure.insert(ProKey(pureTests[i]));
+        for (unsigned i = 0; i < sizeof(impureExpands) / sizeof(impureExpands[0]); ++i)
+            impure.insert(ProKey(impureExpands[i]));
+    }
+
+    QSet<ProKey> pure; // Tests
+    QSet<ProKey> impure; // Expands
+};
+
+const FunctionSets &functionSets()
+{
+    static const FunctionSets sets;
+    return sets;
+}
+
+struct Scan
+{
+    Scan() : items(0), literal(false), pure(true) {}
+
+    void add(const Scan &other)
+    {
+        names += other.names;
+        assigned += other.assigned;
+        pure = pure && other.pure;
+    }
+
+    QSet<ProKey> names; // Which may be read
+    QVector<ProKey> assigned;
+    int items; // Of the last expression
+    bool literal; // The last expression is a single literal, stored in key
+    ProKey key;
+    bool pure; // Only assignments to literal names and calls of pure builtins
+};
+
+class DemandAnalyzer
+{
+public:
+    typedef QMakeEvaluator::DemandState State;
+
+    DemandAnalyzer(QMakeEvaluator *evaluator, State *state, State::Statements *statements)
+        : m_evaluator(evaluator), m_state(state), m_statements(statements),
+          m_pureTests(functionSets().pure), m_impureExpands(functionSets().impure)
+    {
+    }
+
+    void analyze(const ushort *tokPtr)
+    {
+        m_base = m_evaluator->m_current.pro->tokPtr();
+        Scan top;
+        block(tokPtr, true, &top);
+    }
+
+private:
+    ProKey mapped(const ProKey &name) const
+    {
+        return statics.varMap.value(name, name);
+    }
+
+    void makeRelevant(const QSet<ProKey> &names)
+    {
+        foreach (const ProKey &name, names)
+            m_state->markRelevant(name);
+    }
+
+    void record(const ushort *start, const ushort *end, bool branch,
+                const QVector<ProKey> &assigned)
+    {
+        State::Statement &statement = (*m_statements)[start - m_base];
+        statement.end = end - m_base;
+        statement.branch = branch;
+        statement.assigned = assigned;
+    }
+
+    // Scans one expression, up to the first token which does not belong to it.
+    void expression(const ushort *&tokPtr, Scan *scan)
+    {
+        scan->items = 0;
+        scan->literal = false;
+        forever {
+            const ushort tok = *tokPtr;
+            switch (tok & TokMask) {
+            case TokLine:
+                tokPtr += 2;
+                continue;
+            case TokLiteral:
+                ++tokPtr;
+                scan->names.insert(m_evaluator->getStr(tokPtr).toKey());
+                break;
+            case TokHashLiteral:
+                ++tokPtr;
+                scan->key = m_evaluator->getHashStr(tokPtr);
+                scan->names.insert(scan->key);
+                scan->literal = !scan->items;
+                ++scan->items;
+                continue;
+            case TokVariable:
+                ++tokPtr;
+                scan->names.insert(mapped(m_evaluator->getHashStr(tokPtr)));
+                break;
+            case TokProperty:
+                ++tokPtr;
+                skipHashStr(tokPtr);
+                break;
+            case TokEnvVar:
+                ++tokPtr;
+                skipStr(tokPtr);
+                break;
+            case TokFuncName: {
+                ++tokPtr;
+                const ProKey name = m_evaluator->getHashStr(tokPtr);
+                if (!statics.expands.contains(name) || m_impureExpands.contains(name))
+                    scan->pure = false;
+                arguments(tokPtr, scan);
+                break; }
+            default:
+                return;
+            }
+            scan->literal = false;
+            ++scan->items;
+        }
+    }
+
+    // Scans function arguments, including the terminator.
+    void arguments(const ushort *&tokPtr, Scan *scan)
+    {
+        Scan args;
+        forever {
+            expression(tokPtr, &args);
+            if (*tokPtr++ == TokFuncTerminator)
+                break;
+        }
+        scan->names += args.names;
+        scan->pure = scan->pure && args.pure;
+    }
+
+    // Scans statements up to and including the terminator of the block. Everything found is
+    // added to outer.
+    void block(const ushort *&tokPtr, bool candidates, Scan *outer)
+    {
+        forever {
+            const ushort *start = tokPtr;
+            const ushort *exprStart = 0;
+            Scan chain; // Conditions and tests so far
+            Scan expr;
+            bool inChain = false;
+            forever {
+                const ushort tok = *tokPtr;
+                if (tok == TokTerminator) {
+                    ++tokPtr;
+                    chain.add(expr);
+                    endChain(chain, outer);
+                    return;
+                }
+                if (tok == TokLine) {
+                    tokPtr += 2;
+                    continue;
+                }
+                if (tok == TokNot || tok == TokAnd || tok == TokOr) {
+                    ++tokPtr;
+                    inChain = true;
+                    continue;
+                }
+                if (tok == TokCondition) {
+                    ++tokPtr;
+                    chain.add(expr);
+                    expr = Scan();
+                    inChain = true;
+                    continue;
+                }
+                if (tok == TokTestCall) {
+                    ++tokPtr;
+                    if (!expr.literal || !m_pureTests.contains(expr.key))
+                        chain.pure = false;
+                    chain.add(expr);
+                    expr = Scan();
+                    arguments(tokPtr, &chain);
+                    inChain = true;
+                    continue;
+                }
+                if (tok >= TokAssign && tok <= TokReplace) {
+                    tokPtr += 2; // Operator and size hint
+                    Scan value;
+                    expression(tokPtr, &value);
+                    ++tokPtr; // TokValueTerminator
+                    if (expr.literal) {
+                        const ProKey variable = mapped(expr.key);
+                        m_state->addSources(variable, value.names);
+                        if (candidates && value.pure)
+                            record(inChain ? exprStart : start, tokPtr, false,
+                                   QVector<ProKey>() << variable);
+                        value.assigned << variable;
+                    } else {
+                        makeRelevant(expr.names);
+                        makeRelevant(value.names);
+                        value.pure = false;
+                    }
+                    endChain(chain, outer);
+                    outer->add(value);
+                    break;
+                }
+                if (tok == TokBranch) {
+                    ++tokPtr;
+                    chain.add(expr);
+                    Scan blocks;
+                    for (int i = 0; i < 2; ++i) {
+                        const uint len = blockLen(tokPtr);
+                        if (len) {
+                            const ushort *blockPtr = tokPtr;
+                            block(blockPtr, candidates, &blocks);
+                        }
+                        tokPtr += len;
+                    }
+                    chain.add(blocks);
+                    if (chain.pure) {
+                        foreach (const ProKey &variable, chain.assigned)
+                            m_state->addSources(variable, chain.names);
+                        if (candidates)
+                            record(start, tokPtr, true, chain.assigned);
+                    } else {
+                        makeRelevant(chain.names);
+                    }
+                    outer->add(chain);
+                    break;
+                }
+                if (tok == TokForLoop) {
+                    ++tokPtr;
+                    chain.add(expr);
+                    chain.names.insert(mapped(m_evaluator->getHashStr(tokPtr)));
+                    const uint exprLen = blockLen(tokPtr);
+                    const ushort *exprPtr = tokPtr;
+                    expression(exprPtr, &chain);
+                    tokPtr += exprLen;
+                    const uint bodyLen = blockLen(tokPtr);
+                    const ushort *bodyPtr = tokPtr;
+                    block(bodyPtr, candidates, &chain);
+                    tokPtr += bodyLen;
+                    makeRelevant(chain.names);
+                    chain.pure = false;
+                    outer->add(chain);
+                    break;
+                }
+                if (tok == TokTestDef || tok == TokReplaceDef) {
+                    ++tokPtr;
+                    skipHashStr(tokPtr);
+                    const uint bodyLen = blockLen(tokPtr);
+                    const ushort *bodyPtr = tokPtr;
+                    Scan body;
+                    block(bodyPtr, false, &body);
+                    tokPtr += bodyLen;
+                    foreach (const ProKey &variable, body.assigned)
+                        body.names.insert(variable);
+                    makeRelevant(body.names);
+                    chain.add(expr);
+                    endChain(chain, outer);
+                    outer->pure = false;
+                    break;
+                }
+                if (tok == TokReturn || tok == TokBreak || tok == TokNext) {
+                    ++tokPtr;
+                    chain.add(expr);
+                    makeRelevant(chain.names);
+                    chain.pure = false;
+                    outer->add(chain);
+                    break;
+                }
+                // Anything else starts an expression: a condition, the name of a test
+                // function, the left hand side of an assignment or a return value.
+                if (!inChain && !exprStart)
+                    start = tokPtr;
+                chain.add(expr);
+                if (expr.items)
+                    inChain = true;
+                expr = Scan();
+                exprStart = tokPtr;
+                expression(tokPtr, &expr);
+                if (tokPtr == exprStart) { // Malformed stream, give up on this file
+                    m_statements->clear();
+                    return;
+                }
+            }
+        }
+    }
+
+    // Tests which are not followed by a branch only matter for their side effects.
+    void endChain(const Scan &chain, Scan *outer)
+    {
+        if (!chain.pure)
+            makeRelevant(chain.names);
+        outer->add(chain);
+    }
+
+    QMakeEvaluator *m_evaluator;
+    State *m_state;
+    State::Statements *m_statements;
+    const ushort *m_base;
+    const QSet<ProKey> &m_pureTests;
+    const QSet<ProKey> &m_impureExpands;
+};
+
+} // namespace
+
+void QMakeEvaluator::setTargetVariables(const ProStringList &names)
+{
+    if (names.isEmpty()) {
+        m_demand.clear();
+        return;
+    }
+    m_demand = QSharedPointer<DemandState>(new DemandState);
+    foreach (const ProString &name, names) {
+        if (name.startsWith(QLatin1Char('*')))
+            m_demand->relevantSuffixes << name.mid(1).toQString();
+        else
+            m_demand->markRelevant(name.toKey());
+    }
+    for (unsigned i = 0; i < sizeof(evaluatorVariables) / sizeof(evaluatorVariables[0]); ++i)
+        m_demand->markRelevant(ProKey(evaluatorVariables[i]));
+}
+
+bool QMakeEvaluator::skippedVariablesRead() const
+{
+    return m_demand && m_demand->skippedRead;
+}
+
+void QMakeEvaluator::analyzeDemand(ProFile *pro)
+{
+    if (m_demand->files.contains(pro))
+        return;
+    pro->ref();
+    DemandState::Statements &statements = m_demand->files[pro];
+    const Location current = m_current;
+    m_current.pro = pro;
+    DemandAnalyzer(this, m_demand.data(), &statements).analyze(pro->tokPtr());
+    m_current = current;
+}
+
+// Returns the end of the statement at tokPtr if it can be skipped, otherwise null.
+const ushort *QMakeEvaluator::irrelevantStatementEnd(const ushort *tokPtr, bool *branch)
+{
+    QHash<ProFile *, DemandState::Statements>::ConstIterator file =
+            m_demand->files.constFind(m_current.pro);
+    if (file == m_demand->files.constEnd())
+        return 0;
+    const ushort *base = m_current.pro->tokPtr();
+    DemandState::Statements::ConstIterator it = file->constFind(tokPtr - base);
+    if (it == file->constEnd())
+        return 0;
+    foreach (const ProKey &variable, it->assigned) {
+        if (m_demand->isRelevant(variable))
+            return 0;
+    }
+    foreach (const ProKey &variable, it->assigned)
+        m_demand->skipped.insert(variable);
+    *branch = it->branch;
+    return base + it->end;
+}
+
+// An empty name stands for all variables.
+void QMakeEvaluator::noteVariableRead(const ProKey &variableName) const
+{
+    if (m_demand->skipped.isEmpty() || m_demand->skippedRead)
+        return;
+    if (variableName.isEmpty() || m_demand->skipped.contains(variableName))
+        m_demand->skippedRead = true;
+}
+
+QT_END_NAMESPACE
@@ -10,7 +10,9 @@
 #include "qmakeparser.h"
 #include "ioutils.h"
 
+#include <qatomic.h>
 #include <qbytearray.h>
+#include <qcache.h>
 #include <qdatetime.h>
 #include <qdebug.h>
 #include <qdir.h>
@@ -58,7 +60,7 @@ bool operator==(const QMakeBaseKey &one, const QMakeBaseKey &two)
 }
 
 QMakeBaseEnv::QMakeBaseEnv()
-    : evaluator(0)
+    : evaluator(0), checked(true)
 {
 #ifdef PROEVALUATOR_THREAD_SAFE
     inProgress = false;
@@ -91,6 +93,9 @@ void QMakeEvaluator::initStatics()
     statics.strforever = QLatin1String("forever");
     statics.strhost_build = QLatin1String("host_build");
     statics.strTEMPLATE = ProKey("TEMPLATE");
+    statics.strCONFIG.intern();
+    statics.strARGS.intern();
+    statics.strTEMPLATE.intern();
 #ifdef PROEVALUATOR_FULL
     statics.strREQUIRES = ProKey("REQUIRES");
 #endif
@@ -151,6 +156,7 @@ QMakeEvaluator::QMakeEvaluator(QMakeGlobals *option,
 
     // Configuration, more or less
     m_caller = 0;
+    m_baseEnv = 0;
 #ifdef PROEVALUATOR_CUMULATIVE
     m_cumulative = false;
 #endif
@@ -161,6 +167,7 @@ QMakeEvaluator::QMakeEvaluator(QMakeGlobals *option,
     m_skipLevel = 0;
 #endif
     m_listCount = 0;
+    m_scopeGeneration = 0;
     m_valuemapStack.push(ProValueMap());
     m_valuemapInited = false;
 }
@@ -174,11 +181,13 @@ void QMakeEvaluator::initFrom(const QMakeEvaluator &other)
     Q_ASSERT_X(&other, "QMakeEvaluator::visitProFile", "Project not prepared");
     m_functionDefs = other.m_functionDefs;
     m_valuemapStack = other.m_valuemapStack;
+    m_scopeCache.clear();
     m_valuemapInited = true;
     m_qmakespec = other.m_qmakespec;
     m_qmakespecName = other.m_qmakespecName;
     m_mkspecPaths = other.m_mkspecPaths;
     m_featureRoots = other.m_featureRoots;
+    m_featureIndex = other.m_featureIndex;
     m_dirSep = other.m_dirSep;
 }
 
@@ -191,21 +200,36 @@ uint QMakeEvaluator::getBlockLen(const ushort *&tokPtr)
     return len;
 }
 
-ProString QMakeEvaluator::getStr(const ushort *&tokPtr)
+ProString QMakeEvaluator::getStr(ProFile *pro, const ushort *&tokPtr)
 {
     uint len = *tokPtr++;
-    ProString ret(m_current.pro->items(), tokPtr - m_current.pro->tokPtr(), len);
-    ret.setSource(m_current.pro);
+    ProString ret(pro->items(), tokPtr - pro->tokPtr(), len);
+    ret.setSource(pro);
     tokPtr += len;
     return ret;
 }
 
-ProKey QMakeEvaluator::getHashStr(const ushort *&tokPtr)
+// The atom slot of a name in the token stream. Evaluations of a shared ProFile may record the
+// atom concurrently, so the slot is only accessed atomically.
+static inline QAtomicInteger<ushort> *atomSlot(const ushort *tokPtr)
+{
+    return reinterpret_cast<QAtomicInteger<ushort> *>(const_cast<ushort *>(tokPtr));
+}
+
+ProKey QMakeEvaluator::getHashStr(ProFile *pro, const ushort *&tokPtr)
 {
     uint hash = getBlockLen(tokPtr);
     uint len = *tokPtr++;
-    ProKey ret(m_current.pro->items(), tokPtr - m_current.pro->tokPtr(), len, hash);
+    ProKey ret(pro->items(), tokPtr - pro->tokPtr(), len, hash,
+               atomSlot(tokPtr + len)->loadAcquire());
     tokPtr += len;
+    if (!ret.atom()) {
+        // Record the atom in the token stream, so the next visit does not need the lock.
+        // Concurrent evaluations would store the same value.
+        if (ushort atom = ret.intern())
+            atomSlot(tokPtr)->storeRelease(atom);
+    }
+    tokPtr++;
     return ret;
 }
 
@@ -219,7 +243,7 @@ void QMakeEvaluator::skipHashStr(const ushort *&tokPtr)
 {
     tokPtr += 2;
     uint len = *tokPtr++;
-    tokPtr += len;
+    tokPtr += len + 1;
 }
 
 // FIXME: this should not build new strings for direct sections.
@@ -282,9 +306,22 @@ static void zipEmpty(ProStringList *value)
 
 static void insertUnique(ProStringList *varlist, const ProStringList &value)
 {
-    foreach (const ProString &str, value)
-        if (!str.isEmpty() && !varlist->contains(str))
+    if (qint64(varlist->size() + value.size()) * value.size() < ProStringList::HashThreshold) {
+        foreach (const ProString &str, value)
+            if (!str.isEmpty() && !varlist->contains(str))
+                varlist->append(str);
+        return;
+    }
+    QSet<ProString> present;
+    present.reserve(varlist->size() + value.size());
+    foreach (const ProString &str, *varlist)
+        present.insert(str);
+    foreach (const ProString &str, value) {
+        if (!str.isEmpty() && !present.contains(str)) {
+            present.insert(str);
             varlist->append(str);
+        }
+    }
 }
 
 static void removeAll(ProStringList *varlist, const ProString &value)
@@ -296,9 +333,96 @@ static void removeAll(ProStringList *varlist, const ProString &value)
 
 void QMakeEvaluator::removeEach(ProStringList *varlist, const ProStringList &value)
 {
+    const int n = varlist->size();
+    if (qint64(n) * value.size() < ProStringList::HashThreshold) {
+        foreach (const ProString &str, value)
+            if (!str.isEmpty())
+                removeAll(varlist, str);
+        return;
+    }
+    QSet<ProString> removed;
+    removed.reserve(value.size());
     foreach (const ProString &str, value)
         if (!str.isEmpty())
-            removeAll(varlist, str);
+            removed.insert(str);
+    // Compact in place, so that the remaining values keep their order.
+    int j = 0;
+    for (int i = 0; i < n; ++i) {
+        const ProString &s = varlist->at(i);
+        if (removed.contains(s))
+            continue;
+        if (j != i)
+            (*varlist)[j] = s;
+        ++j;
+    }
+    if (n != j)
+        varlist->erase(varlist->begin() + j, varlist->end());
+}
+
+namespace {
+
+struct PatternKey
+{
+    QString pattern;
+    QRegExp::PatternSyntax syntax;
+    Qt::CaseSensitivity cs;
+};
+
+uint qHash(const PatternKey &key)
+{
+    return qHash(key.pattern) ^ (uint(key.syntax) << 1) ^ uint(key.cs);
+}
+
+bool operator==(const PatternKey &one, const PatternKey &two)
+{
+    return one.syntax == two.syntax && one.cs == two.cs && one.pattern == two.pattern;
+}
+
+// Patterns are mostly literals from the project files and features, so a
+// small cache covers the working set of even large trees.
+struct PatternCache
+{
+    PatternCache() : patterns(256), hits(0), misses(0) {}
+
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutex mutex;
+#endif
+    QCache<PatternKey, QRegExp> patterns; // Least recently used ones are dropped first
+    qint64 hits, misses;
+};
+
+}
+
+Q_GLOBAL_STATIC(PatternCache, patternCache)
+
+QRegExp QMakeEvaluator::compiledPattern(const QString &pattern, QRegExp::PatternSyntax syntax,
+                                        Qt::CaseSensitivity cs)
+{
+    PatternCache *cache = patternCache();
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&cache->mutex);
+#endif
+    PatternKey key = { pattern, syntax, cs };
+    if (const QRegExp *regexp = cache->patterns.object(key)) {
+        ++cache->hits;
+        // Copies share the compiled engine.
+        return *regexp;
+    }
+    ++cache->misses;
+    key.pattern.detach(); // The pattern may be an m_tmp
+    QRegExp *regexp = new QRegExp(key.pattern, cs, syntax);
+    cache->patterns.insert(key, regexp);
+    return *regexp;
+}
+
+void QMakeEvaluator::patternCacheStats(qint64 *hits, qint64 *misses)
+{
+    PatternCache *cache = patternCache();
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&cache->mutex);
+#endif
+    *hits = cache->hits;
+    *misses = cache->misses;
 }
 
 static void replaceInList(ProStringList *varlist,
@@ -418,7 +542,7 @@ void QMakeEvaluator::evaluateExpression(
             break; }
         case TokEnvVar: {
             const ProString &var = getStr(tokPtr);
-            const ProStringList &val = split_value_list(m_option->getEnv(var.toQString(m_tmp1)));
+            const ProStringList &val = split_value_list(getEnv(var.toQString(m_tmp1)));
             debugMsg(2, "env var %s => %s", dbgStr(var), dbgStrList(val));
             addStrList(val, tok, ret, pending, joined);
             break; }
@@ -480,18 +604,39 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::visitProBlock(
 {
     m_current.pro = pro;
     m_current.line = 0;
+    pro->noteVisit();
+    if (m_demand)
+        analyzeDemand(pro);
     return visitProBlock(tokPtr);
 }
 
 QMakeEvaluator::VisitReturn QMakeEvaluator::visitProBlock(
         const ushort *tokPtr)
 {
+    // The cumulative and demand-driven modes only exist in the token visitor.
+    if (!m_cumulative && !m_demand) {
+        if (const ProCode *code = compiledCode(m_current.pro)) {
+            const int entry = code->entries.value(tokPtr - m_current.pro->tokPtr(), -1);
+            if (entry >= 0)
+                return visitCode(*code, entry);
+        }
+    }
     traceMsg("entering block");
     ProStringList curr;
     bool okey = true, or_op = false, invert = false;
     uint blockLen;
     while (ushort tok = *tokPtr++) {
         VisitReturn ret;
+        if (m_demand && curr.isEmpty()) {
+            bool branch;
+            if (const ushort *end = irrelevantStatementEnd(tokPtr - 1, &branch)) {
+                traceMsg("skipped irrelevant statement");
+                tokPtr = end;
+                if (branch)
+                    okey = true, or_op = false, invert = false; // As after any branch
+                continue;
+            }
+        }
         switch (tok) {
         case TokLine:
             m_current.line = *tokPtr++;
@@ -695,14 +840,19 @@ void QMakeEvaluator::visitProFunctionDef(
 }
 
 QMakeEvaluator::VisitReturn QMakeEvaluator::visitProLoop(
-        const ProKey &_variable, const ushort *exprPtr, const ushort *tokPtr)
+        const ProKey &variable, const ushort *exprPtr, const ushort *tokPtr)
+{
+    return visitProLoop(variable, expandVariableReferences(exprPtr, 0, true).at(0), tokPtr);
+}
+
+QMakeEvaluator::VisitReturn QMakeEvaluator::visitProLoop(
+        const ProKey &_variable, ProString it_list, const ushort *tokPtr)
 {
     VisitReturn ret = ReturnTrue;
     bool infinite = false;
     int index = 0;
     ProKey variable;
     ProStringList oldVarVal;
-    ProString it_list = expandVariableReferences(exprPtr, 0, true).at(0);
     if (_variable.isEmpty()) {
         if (it_list != statics.strever) {
             evalError(fL1S("Invalid loop expression."));
@@ -800,11 +950,16 @@ void QMakeEvaluator::visitProVariable(
         return;
     }
     const ProKey &varName = map(curr.first());
+    ProStringList varVal = expandVariableReferences(tokPtr, sizeHint, tok == TokReplace);
+    applyVariableOperation(tok, varName, varVal);
+}
 
+void QMakeEvaluator::applyVariableOperation(
+        ushort tok, const ProKey &varName, ProStringList &varVal)
+{
     if (tok == TokReplace) {      // ~=
         // DEFINES ~= s/a/b/?[gqi]
 
-        const ProStringList &varVal = expandVariableReferences(tokPtr, sizeHint, true);
         const QString &val = varVal.at(0).toQString(m_tmp1);
         if (val.length() < 4 || val.at(0) != QLatin1Char('s')) {
             evalError(fL1S("The ~= operator can handle only the s/// function."));
@@ -828,14 +983,17 @@ void QMakeEvaluator::visitProVariable(
         if (quote)
             pattern = QRegExp::escape(pattern);
 
-        QRegExp regexp(pattern, case_sense ? Qt::CaseSensitive : Qt::CaseInsensitive);
+        const QRegExp regexp = compiledPattern(pattern, QRegExp::RegExp,
+                                               case_sense ? Qt::CaseSensitive : Qt::CaseInsensitive);
 
+        if (varName == statics.strCONFIG)
+            detachConfigIndex();
         // We could make a union of modified and unmodified values,
         // but this will break just as much as it fixes, so leave it as is.
         replaceInList(&valuesRef(varName), regexp, replace, global, m_tmp2);
         debugMsg(2, "replaced %s with %s", dbgQStr(pattern), dbgQStr(replace));
     } else {
-        ProStringList varVal = expandVariableReferences(tokPtr, sizeHint);
+        const bool configIndexed = varName == statics.strCONFIG && detachConfigIndex();
         switch (tok) {
         default: // whatever - cannot happen
         case TokAssign:          // =
@@ -884,6 +1042,8 @@ void QMakeEvaluator::visitProVariable(
             debugMsg(2, "removing");
             break;
         }
+        if (configIndexed)
+            updateConfigIndex(tok, varVal);
     }
     traceMsg("%s := %s", dbgKey(varName), dbgStrList(values(varName)));
 
@@ -975,12 +1135,12 @@ void QMakeEvaluator::loadDefaults()
 
 # if defined(Q_CC_MSVC) // ### bogus condition, but nobody x-builds for msvc with a different qmake
     QLatin1Char backslash('\\');
-    QString paths = m_option->getEnv(QLatin1String("PATH"));
-    QString vcBin64 = m_option->getEnv(QLatin1String("VCINSTALLDIR"));
+    QString paths = getEnv(QLatin1String("PATH"));
+    QString vcBin64 = getEnv(QLatin1String("VCINSTALLDIR"));
     if (!vcBin64.endsWith(backslash))
         vcBin64.append(backslash);
     vcBin64.append(QLatin1String("bin\\amd64"));
-    QString vcBinX86_64 = m_option->getEnv(QLatin1String("VCINSTALLDIR"));
+    QString vcBinX86_64 = getEnv(QLatin1String("VCINSTALLDIR"));
     if (!vcBinX86_64.endsWith(backslash))
         vcBinX86_64.append(backslash);
     vcBinX86_64.append(QLatin1String("bin\\x86_amd64"));
@@ -1016,7 +1176,7 @@ bool QMakeEvaluator::prepareProject(const QString &inDir)
             superdir = m_outputDir;
             forever {
                 QString superfile = superdir + QLatin1String("/.qmake.super");
-                if (IoUtils::exists(superfile)) {
+                if (exists(superfile)) {
                     m_superfile = superfile;
                     break;
                 }
@@ -1031,10 +1191,10 @@ bool QMakeEvaluator::prepareProject(const QString &inDir)
             QString dir = m_outputDir;
             forever {
                 conffile = sdir + QLatin1String("/.qmake.conf");
-                if (!IoUtils::exists(conffile))
+                if (!exists(conffile))
                     conffile.clear();
                 cachefile = dir + QLatin1String("/.qmake.cache");
-                if (!IoUtils::exists(cachefile))
+                if (!exists(cachefile))
                     cachefile.clear();
                 if (!conffile.isEmpty() || !cachefile.isEmpty()) {
                     if (dir != sdir)
@@ -1121,7 +1281,7 @@ bool QMakeEvaluator::loadSpecInternal()
 
 bool QMakeEvaluator::loadSpec()
 {
-    QString qmakespec = m_option->expandEnvVars(
+    QString qmakespec = expandEnvVars(
                 m_hostBuild ? m_option->qmakespec : m_option->xqmakespec);
 
     {
@@ -1165,7 +1325,7 @@ bool QMakeEvaluator::loadSpec()
     if (IoUtils::isRelativePath(qmakespec)) {
         foreach (const QString &root, m_mkspecPaths) {
             QString mkspec = root + QLatin1Char('/') + qmakespec;
-            if (IoUtils::exists(mkspec)) {
+            if (exists(mkspec)) {
                 qmakespec = mkspec;
                 goto cool;
             }
@@ -1276,6 +1436,15 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::visitProFile(
                     return ReturnFalse;
             } else
 #endif
+            {
+                // Files may have changed since the baseline was loaded in an earlier request.
+                if (baseEnv->evaluator && !baseEnv->checked
+                        && baseEnvStamps(*baseEnv) != baseEnv->stamps) {
+                    delete baseEnv->evaluator;
+                    baseEnv->evaluator = 0;
+                }
+                baseEnv->checked = true;
+            }
             if (!baseEnv->evaluator) {
 #ifdef PROEVALUATOR_THREAD_SAFE
                 baseEnv->inProgress = true;
@@ -1290,7 +1459,18 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::visitProFile(
                 baseEval->m_sourceRoot = m_sourceRoot;
                 baseEval->m_buildRoot = m_buildRoot;
                 baseEval->m_hostBuild = m_hostBuild;
-                bool ok = baseEval->loadSpec();
+                baseEval->m_baseEnv = baseEnv;
+                baseEnv->files.clear();
+                baseEnv->dependencies.clear();
+                const QString snapshot = baseEval->snapshotFileName();
+                bool ok = !snapshot.isEmpty() && baseEval->restoreSnapshot(snapshot);
+                if (!ok) {
+                    ok = baseEval->loadSpec();
+                    if (ok && !snapshot.isEmpty())
+                        baseEval->saveSnapshot(snapshot, *baseEnv);
+                }
+                baseEval->m_baseEnv = 0;
+                baseEnv->stamps = ok ? baseEval->baseEnvStamps(*baseEnv) : QStringList();
 
 #ifdef PROEVALUATOR_THREAD_SAFE
                 locker.relock();
@@ -1306,6 +1486,13 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::visitProFile(
         }
 #endif
 
+        // Later evaluations do not load the baseline files, but depend on them all the same.
+        foreach (const QString &file, baseEnv->files)
+            m_handler->dependsOn(QMakeHandler::DependFileContents, file);
+        for (int i = 0; i < baseEnv->dependencies.size(); ++i) {
+            m_handler->dependsOn(QMakeHandler::DependencyType(baseEnv->dependencies.at(i).first),
+                                 baseEnv->dependencies.at(i).second);
+        }
         initFrom(*baseEnv->evaluator);
     } else {
         if (!m_valuemapInited)
@@ -1316,6 +1503,7 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::visitProFile(
     for (ProValueMap::ConstIterator it = m_extraVars.constBegin();
          it != m_extraVars.constEnd(); ++it)
         m_valuemapStack.first().insert(it.key(), it.value());
+    invalidateScopeCache();
 #endif
 
     VisitReturn vr;
@@ -1428,7 +1616,7 @@ void QMakeEvaluator::updateFeaturePaths()
         while (!specdir.isRoot() && specdir.cdUp()) {
             const QString specpath = specdir.path();
             if (specpath.endsWith(mkspecs_concat)) {
-                if (IoUtils::exists(specpath + features_concat))
+                if (exists(specpath + features_concat))
                     feature_bases << specpath;
                 break;
             }
@@ -1452,7 +1640,7 @@ void QMakeEvaluator::updateFeaturePaths()
 
     QStringList ret;
     foreach (const QString &root, feature_roots)
-        if (IoUtils::exists(root))
+        if (exists(root))
             ret << root;
     m_featureRoots = ret;
 }
@@ -1490,6 +1678,97 @@ QString QMakeEvaluator::currentDirectory() const
     return QString();
 }
 
+void QMakeEvaluator::dependsOn(QMakeHandler::DependencyType type, const QString &path) const
+{
+    m_handler->dependsOn(type, path);
+    if (m_baseEnv)
+        m_baseEnv->dependencies << qMakePair(int(type), path);
+}
+
+QString QMakeEvaluator::getEnv(const QString &var) const
+{
+    dependsOn(QMakeHandler::DependEnvironment, var);
+    return m_option->getEnv(var);
+}
+
+QString QMakeEvaluator::expandEnvVars(const QString &str) const
+{
+    QStringList names;
+    const QString ret = m_option->expandEnvVars(str, &names);
+    foreach (const QString &name, names)
+        dependsOn(QMakeHandler::DependEnvironment, name);
+    return ret;
+}
+
+FileTypeCache *QMakeEvaluator::fileTypeCache() const
+{
+    if (m_option->file_type_cache)
+        return m_option->file_type_cache;
+    // Files evaluated into separate scopes belong to the same evaluation.
+    const QMakeEvaluator *evaluator = this;
+    while (evaluator->m_caller)
+        evaluator = evaluator->m_caller;
+    return &evaluator->m_fileTypeCache;
+}
+
+QMakeEvaluator::ConfigIndex &QMakeEvaluator::configIndex()
+{
+    const ProStringList &config = values(statics.strCONFIG);
+    ConfigIndex &index = m_configIndex;
+    if (!index.valid || config.constData() != index.values.constData()) {
+        index.values = config;
+        index.lastPosition.clear();
+        index.lastPosition.reserve(config.size());
+        for (int i = 0; i < config.size(); ++i)
+            index.lastPosition[config.at(i)] = i;
+        index.nextPosition = config.size();
+        index.wildcards.clear();
+        index.valid = true;
+    }
+    return index;
+}
+
+// Called right before CONFIG is modified. Returns whether the index was up to date,
+// so updateConfigIndex() may be used afterwards.
+bool QMakeEvaluator::detachConfigIndex()
+{
+    ConfigIndex &index = m_configIndex;
+    const bool current = index.valid
+            && values(statics.strCONFIG).constData() == index.values.constData();
+    // Let the modification happen in place
+    index.values = ProStringList();
+    index.valid = false;
+    return current;
+}
+
+void QMakeEvaluator::updateConfigIndex(ushort tok, const ProStringList &varVal)
+{
+    ConfigIndex &index = m_configIndex;
+    switch (tok) {
+    case TokAppend:
+        foreach (const ProString &str, varVal)
+            index.lastPosition[str] = index.nextPosition++;
+        break;
+    case TokAppendUnique:
+        foreach (const ProString &str, varVal)
+            if (!str.isEmpty() && !index.lastPosition.contains(str))
+                index.lastPosition.insert(str, index.nextPosition++);
+        break;
+    case TokRemove:
+        if (!m_cumulative) {
+            foreach (const ProString &str, varVal)
+                if (!str.isEmpty())
+                    index.lastPosition.remove(str);
+        }
+        break;
+    default:
+        return; // Rebuilt on demand
+    }
+    index.values = values(statics.strCONFIG);
+    index.wildcards.clear();
+    index.valid = true;
+}
+
 bool QMakeEvaluator::isActiveConfig(const QString &config, bool regex)
 {
     // magic types for easy flipping
@@ -1502,34 +1781,67 @@ bool QMakeEvaluator::isActiveConfig(const QString &config, bool regex)
         return m_hostBuild;
 
     if (regex && (config.contains(QLatin1Char('*')) || config.contains(QLatin1Char('?')))) {
+        ConfigIndex &index = configIndex();
+        if (index.specName != m_qmakespecName) {
+            index.specName = m_qmakespecName;
+            index.wildcards.clear();
+        }
+        QHash<QString, bool>::ConstIterator it = index.wildcards.constFind(config);
+        if (it != index.wildcards.constEnd())
+            return *it;
+
         QString cfg = config;
-        cfg.detach(); // Keep m_tmp out of QRegExp's cache
-        QRegExp re(cfg, Qt::CaseSensitive, QRegExp::Wildcard);
+        cfg.detach(); // Keep m_tmp out of the wildcard results
+        const QRegExp re = compiledPattern(cfg, QRegExp::Wildcard);
+        bool matched = false;
 
         // mkspecs
-        if (re.exactMatch(m_qmakespecName))
-            return true;
-
-        // CONFIG variable
-        int t = 0;
-        foreach (const ProString &configValue, values(statics.strCONFIG)) {
-            if (re.exactMatch(configValue.toQString(m_tmp[t])))
-                return true;
-            t ^= 1;
+        if (re.exactMatch(m_qmakespecName)) {
+            matched = true;
+        } else {
+            // CONFIG variable
+            int t = 0;
+            foreach (const ProString &configValue, index.values) {
+                if (re.exactMatch(configValue.toQString(m_tmp[t]))) {
+                    matched = true;
+                    break;
+                }
+                t ^= 1;
+            }
         }
+        index.wildcards.insert(cfg, matched);
+        return matched;
     } else {
         // mkspecs
         if (m_qmakespecName == config)
             return true;
 
         // CONFIG variable
-        if (values(statics.strCONFIG).contains(ProString(config)))
+        if (configIndex().lastPosition.contains(ProString(config)))
             return true;
     }
 
     return false;
 }
 
+// Returns the index of the one of the mutually exclusive values which comes last in CONFIG,
+// or -1 if none of them is in CONFIG.
+int QMakeEvaluator::lastActiveConfig(const QStringList &mutuals)
+{
+    const ConfigIndex &index = configIndex();
+    int ret = -1;
+    int last = -1;
+    for (int mut = 0; mut < mutuals.count(); mut++) {
+        QHash<ProString, int>::ConstIterator it =
+                index.lastPosition.constFind(ProString(mutuals.at(mut).trimmed()));
+        if (it != index.lastPosition.constEnd() && *it > last) {
+            last = *it;
+            ret = mut;
+        }
+    }
+    return ret;
+}
+
 ProStringList QMakeEvaluator::expandVariableReferences(
         const ushort *&tokPtr, int sizeHint, bool joined)
 {
@@ -1638,9 +1950,18 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateBoolFunction(
 QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateConditionalFunction(
         const ProKey &func, const ushort *&tokPtr)
 {
-    if (int func_t = statics.functions.value(func)) {
+    int func_t;
+    if (ushort atom = func.atom())
+        func_t = atom < statics.functionsByAtom.size() ? statics.functionsByAtom.at(atom) : 0;
+    else
+        func_t = statics.functions.value(func);
+    if (func_t) {
         //why don't the builtin functions just use args_list? --Sam
-        return evaluateBuiltinConditional(func_t, func, expandVariableReferences(tokPtr, 5, true));
+        const ProStringList args = expandVariableReferences(tokPtr, 5, true);
+        m_handler->aboutToCallBuiltin(func);
+        const VisitReturn ret = evaluateBuiltinConditional(func_t, func, args);
+        m_handler->doneWithBuiltin(func);
+        return ret;
     }
 
     QHash<ProKey, ProFunctionDef>::ConstIterator it =
@@ -1659,9 +1980,18 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateConditionalFunction(
 ProStringList QMakeEvaluator::evaluateExpandFunction(
         const ProKey &func, const ushort *&tokPtr)
 {
-    if (int func_t = statics.expands.value(func)) {
+    int func_t;
+    if (ushort atom = func.atom())
+        func_t = atom < statics.expandsByAtom.size() ? statics.expandsByAtom.at(atom) : 0;
+    else
+        func_t = statics.expands.value(func);
+    if (func_t) {
         //why don't the builtin functions just use args_list? --Sam
-        return evaluateBuiltinExpand(func_t, func, expandVariableReferences(tokPtr, 5, true));
+        const ProStringList args = expandVariableReferences(tokPtr, 5, true);
+        m_handler->aboutToCallBuiltin(func);
+        ProStringList ret = evaluateBuiltinExpand(func_t, func, args);
+        m_handler->doneWithBuiltin(func);
+        return ret;
     }
 
     QHash<ProKey, ProFunctionDef>::ConstIterator it =
@@ -1702,59 +2032,121 @@ void QMakeEvaluator::checkRequirements(const ProStringList &deps)
 }
 #endif
 
-ProValueMap *QMakeEvaluator::findValues(const ProKey &variableName, ProValueMap::Iterator *rit)
-{
-    ProValueMapStack::Iterator vmi = m_valuemapStack.end();
-    do {
-        --vmi;
-        ProValueMap::Iterator it = (*vmi).find(variableName);
-        if (it != (*vmi).end()) {
-            if (it->constBegin() == statics.fakeValue.constBegin())
-                return 0;
+// Finds the innermost frame below the top one which has an entry for the variable.
+// The answers are cached, so a read of a global variable in a deeply nested function call
+// only probes the frames pushed since the variable was last read. For shallow stacks the
+// cache would be more expensive than walking the frames, and the base environments, which are
+// read from several threads, never have more than one frame.
+int QMakeEvaluator::findOuterFrame(const ProKey &variableName,
+                                   ProValueMap::ConstIterator *rit) const
+{
+    const int frames = m_valuemapStack.size() - 1;
+    int probeTo = 0;
+    int known = -1; // The defining frame among the unprobed ones, if probeTo > 0
+    ScopeLookup *lookup = 0;
+    if (frames > 2) {
+        lookup = &m_scopeCache[variableName];
+        if (lookup->frames && lookup->generation == m_scopeGeneration) {
+            // Frames are only ever pushed on top, and only the top one is assigned to without
+            // invalidating the cache. So the frames up to the innermost common one are still
+            // the same if that one was neither pushed nor the top one since the lookup.
+            const int common = qMin(lookup->frames, frames);
+            if (m_valuemapStack.serial(common - 1) <= lookup->serial) {
+                if (lookup->frames <= frames) {
+                    probeTo = lookup->frames;
+                    known = lookup->frame;
+                } else if (lookup->frame < frames) {
+                    probeTo = frames;
+                    known = lookup->frame;
+                }
+            }
+        }
+    }
+
+    int found = -1;
+    for (int i = frames - 1; i >= probeTo; --i) {
+        const ProValueMap &vmap = m_valuemapStack.frame(i);
+        ProValueMap::ConstIterator it = vmap.constFind(variableName);
+        if (it != vmap.constEnd()) {
             *rit = it;
-            return &(*vmi);
+            found = i;
+            break;
         }
-    } while (vmi != m_valuemapStack.begin());
-    return 0;
+    }
+    if (found < 0 && known >= 0) {
+        // Entries may have been removed from the frame meanwhile.
+        for (int i = known; i >= 0; --i) {
+            const ProValueMap &vmap = m_valuemapStack.frame(i);
+            ProValueMap::ConstIterator it = vmap.constFind(variableName);
+            if (it != vmap.constEnd()) {
+                *rit = it;
+                found = i;
+                break;
+            }
+        }
+    }
+
+    if (lookup) {
+        lookup->frames = frames;
+        lookup->serial = m_valuemapStack.serial(frames - 1);
+        lookup->generation = m_scopeGeneration;
+        lookup->frame = found;
+    }
+    return found;
+}
+
+ProValueMap *QMakeEvaluator::findValues(const ProKey &variableName, ProValueMap::Iterator *rit)
+{
+    if (m_demand)
+        noteVariableRead(variableName);
+    ProValueMap *vmap = &m_valuemapStack.top();
+    ProValueMap::Iterator it = vmap->find(variableName);
+    if (it == vmap->end()) {
+        ProValueMap::ConstIterator cit;
+        const int frame = findOuterFrame(variableName, &cit);
+        if (frame < 0 || cit->constBegin() == statics.fakeValue.constBegin())
+            return 0;
+        vmap = &m_valuemapStack.frame(frame);
+        it = vmap->find(variableName);
+    } else if (it->constBegin() == statics.fakeValue.constBegin()) {
+        return 0;
+    }
+    *rit = it;
+    return vmap;
 }
 
 ProStringList &QMakeEvaluator::valuesRef(const ProKey &variableName)
 {
-    ProValueMap::Iterator it = m_valuemapStack.top().find(variableName);
-    if (it != m_valuemapStack.top().end()) {
+    if (m_demand)
+        noteVariableRead(variableName);
+    ProValueMap &top = m_valuemapStack.top();
+    ProValueMap::Iterator it = top.find(variableName);
+    if (it != top.end()) {
         if (it->constBegin() == statics.fakeValue.constBegin())
             it->clear();
         return *it;
     }
-    ProValueMapStack::Iterator vmi = m_valuemapStack.end();
-    if (--vmi != m_valuemapStack.begin()) {
-        do {
-            --vmi;
-            ProValueMap::ConstIterator it = (*vmi).constFind(variableName);
-            if (it != (*vmi).constEnd()) {
-                ProStringList &ret = m_valuemapStack.top()[variableName];
-                if (it->constBegin() != statics.fakeValue.constBegin())
-                    ret = *it;
-                return ret;
-            }
-        } while (vmi != m_valuemapStack.begin());
+    ProValueMap::ConstIterator cit;
+    if (findOuterFrame(variableName, &cit) >= 0) {
+        ProStringList &ret = top[variableName];
+        if (cit->constBegin() != statics.fakeValue.constBegin())
+            ret = *cit;
+        return ret;
     }
-    return m_valuemapStack.top()[variableName];
+    return top[variableName];
 }
 
 ProStringList QMakeEvaluator::values(const ProKey &variableName) const
 {
-    ProValueMapStack::ConstIterator vmi = m_valuemapStack.constEnd();
-    do {
-        --vmi;
-        ProValueMap::ConstIterator it = (*vmi).constFind(variableName);
-        if (it != (*vmi).constEnd()) {
-            if (it->constBegin() == statics.fakeValue.constBegin())
-                break;
-            return *it;
-        }
-    } while (vmi != m_valuemapStack.constBegin());
-    return ProStringList();
+    if (m_demand)
+        noteVariableRead(variableName);
+    const ProValueMap &top = m_valuemapStack.top();
+    ProValueMap::ConstIterator it = top.constFind(variableName);
+    if (it == top.constEnd() && findOuterFrame(variableName, &it) < 0)
+        return ProStringList();
+    if (it->constBegin() == statics.fakeValue.constBegin())
+        return ProStringList();
+    return *it;
 }
 
 ProString QMakeEvaluator::first(const ProKey &variableName) const
@@ -1768,14 +2160,24 @@ ProString QMakeEvaluator::first(const ProKey &variableName) const
 QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateFile(
         const QString &fileName, QMakeHandler::EvalFileType type, LoadFlags flags)
 {
-    if (ProFile *pro = m_parser->parsedProFile(fileName, true)) {
+    m_handler->aboutToParse(fileName);
+    ProFile *pro = m_parser->parsedProFile(fileName, true);
+    m_handler->doneWithParse(fileName);
+    if (pro) {
+        if (m_baseEnv)
+            m_baseEnv->files.append(fileName);
         m_locationStack.push(m_current);
+#if defined(PROEVALUATOR_THREAD_SAFE) && !defined(QT_BOOTSTRAPPED)
+        if (m_option->prefetch_commands && !m_cumulative && !m_demand)
+            prefetchCommands(pro);
+#endif
         VisitReturn ok = visitProFile(pro, type, flags);
         m_current = m_locationStack.pop();
         pro->deref();
 #ifdef PROEVALUATOR_FULL
         if (ok == ReturnTrue) {
             ProStringList &iif = m_valuemapStack.first()[ProKey("QMAKE_INTERNAL_INCLUDED_FILES")];
+            invalidateScopeCache();
             ProString ifn(fileName);
             if (!iif.contains(ifn))
                 iif << ifn;
@@ -1783,7 +2185,8 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateFile(
 #endif
         return ok;
     } else {
-        if (!(flags & LoadSilent) && !IoUtils::exists(fileName))
+        dependsOn(QMakeHandler::DependFileExistence, fileName);
+        if (!(flags & LoadSilent) && !exists(fileName))
             evalError(fL1S("WARNING: Include file %1 not found").arg(fileName));
         return ReturnFalse;
     }
@@ -1814,6 +2217,10 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateFeatureFile(
 
     if (m_featureRoots.isEmpty())
         updateFeaturePaths();
+    if (!m_featureIndex || m_featureIndex->roots != m_featureRoots) {
+        m_featureIndex = m_option->featureIndex(m_featureRoots, fileTypeCache());
+        m_featureRoots = m_featureIndex->roots; // Share the data, so the check above is cheap
+    }
     int start_root = 0;
     QString currFn = currentFileName();
     if (IoUtils::fileName(currFn) == IoUtils::fileName(fn)) {
@@ -1823,10 +2230,30 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateFeatureFile(
                 break;
             }
     }
-    for (int root = start_root; root < m_featureRoots.size(); ++root) {
-        QString fname = m_featureRoots.at(root) + fn;
-        if (IoUtils::exists(fname)) {
-            fn = fname;
+    if (fn.contains(QLatin1Char('/'))) {
+        // The index only covers the top level of the roots.
+        for (int root = start_root; root < m_featureRoots.size(); ++root) {
+            QString fname = m_featureRoots.at(root) + fn;
+            if (exists(fname)) {
+                fn = fname;
+                goto cool;
+            }
+            // The file would shadow the one found further down.
+            dependsOn(QMakeHandler::DependFileExistence, fname);
+        }
+    } else {
+        int found_root = m_featureRoots.size();
+        foreach (int root, m_featureIndex->find(fn)) {
+            if (root >= start_root) {
+                found_root = root;
+                break;
+            }
+        }
+        // A file in any of the roots before would shadow the one found.
+        for (int root = start_root; root < found_root; ++root)
+            dependsOn(QMakeHandler::DependFileExistence, m_featureRoots.at(root) + fn);
+        if (found_root < m_featureRoots.size()) {
+            fn.prepend(m_featureRoots.at(found_root));
             goto cool;
         }
     }
@@ -1870,6 +2297,7 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateFileInto(
     visitor.m_caller = this;
     visitor.m_outputDir = m_outputDir;
     visitor.m_featureRoots = m_featureRoots;
+    visitor.m_featureIndex = m_featureIndex;
     VisitReturn ret = visitor.evaluateFileChecked(fileName, QMakeHandler::EvalAuxFile, flags);
     if (ret != ReturnTrue)
         return ret;
@@ -1877,6 +2305,7 @@ QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateFileInto(
 #ifdef PROEVALUATOR_FULL
     ProKey qiif("QMAKE_INTERNAL_INCLUDED_FILES");
     ProStringList &iif = m_valuemapStack.first()[qiif];
+    invalidateScopeCache();
     foreach (const ProString &ifn, values->value(qiif))
         if (!iif.contains(ifn))
             iif << ifn;
@@ -2001,4 +2430,581 @@ QString QMakeEvaluator::formatValueListList(const QList<ProStringList> &lists)
 }
 #endif
 
+//////// Lowered token streams /////////
+
+static bool bytecodeEnabled = true;
+
+// Evaluations of a file or of its functions before it is lowered; nested blocks do not count.
+// Files which are only evaluated once, like the statements passed to eval(), are not worth it.
+enum { CompileThreshold = 2 };
+
+namespace {
+
+class CodeCompiler
+{
+public:
+    // Strings are decoded against pro itself, which need not be the current file of an
+    // evaluator; commands are prefetched before a file is entered.
+    explicit CodeCompiler(ProFile *pro)
+        : m_pro(pro), m_base(pro->tokPtr()), m_code(new ProCode) {}
+
+    ProCode *compile()
+    {
+        block(m_base);
+        while (!m_pending.isEmpty()) {
+            const Pending pending = m_pending.takeLast();
+            const int index = block(pending.tokPtr);
+            if (pending.field == 0)
+                m_code->instrs[pending.instr].a = index;
+            else if (pending.field == 1)
+                m_code->instrs[pending.instr].b = index;
+        }
+        m_code->instrs.squeeze();
+        return m_code;
+    }
+
+private:
+    // A nested block whose instructions are emitted after the current one.
+    struct Pending
+    {
+        int instr;
+        int field; // 0 for a, 1 for b, -1 if the block is only entered by token offset
+        const ushort *tokPtr;
+    };
+
+    int emit(ushort tok, int a = 0, int b = 0)
+    {
+        const ProCodeInstr instr = { tok, a, b, m_code->instrs.size() + 1 };
+        m_code->instrs << instr;
+        return instr.next - 1;
+    }
+
+    int addKey(const ProKey &key)
+    {
+        m_code->keys << key;
+        return m_code->keys.size() - 1;
+    }
+
+    // Emits the instructions of a block, including its terminator.
+    int block(const ushort *tokPtr)
+    {
+        const int start = m_code->instrs.size();
+        m_code->entries.insert(tokPtr - m_base, start);
+        int literalName = -1; // The key of the test name, if it is a single literal
+        bool afterExpression = false;
+        forever {
+            const ushort tok = *tokPtr++;
+            switch (tok) {
+            case TokTerminator:
+                emit(tok);
+                return start;
+            case TokLine:
+                emit(tok, *tokPtr++);
+                continue;
+            case TokAssign:
+            case TokAppend:
+            case TokAppendUnique:
+            case TokRemove:
+            case TokReplace: {
+                const int instr = emit(tok, *tokPtr++);
+                expression(tokPtr);
+                emit(*tokPtr++); // TokValueTerminator
+                m_code->instrs[instr].next = m_code->instrs.size();
+                break; }
+            case TokBranch: {
+                const int instr = emit(tok, -1, -1);
+                for (int field = 0; field < 2; ++field) {
+                    const uint len = QMakeEvaluator::getBlockLen(tokPtr);
+                    if (len) {
+                        const Pending pending = { instr, field, tokPtr };
+                        m_pending << pending;
+                    }
+                    tokPtr += len;
+                }
+                break; }
+            case TokForLoop: {
+                const ProKey variable = QMakeEvaluator::getHashStr(m_pro, tokPtr);
+                const int instr = emit(tok, variable.isEmpty() ? -1 : addKey(variable));
+                const uint exprLen = QMakeEvaluator::getBlockLen(tokPtr);
+                const ushort *exprPtr = tokPtr;
+                expression(exprPtr);
+                emit(TokValueTerminator);
+                m_code->instrs[instr].next = m_code->instrs.size();
+                tokPtr += exprLen;
+                const uint bodyLen = QMakeEvaluator::getBlockLen(tokPtr);
+                m_code->instrs[instr].b = tokPtr - m_base;
+                const Pending pending = { instr, -1, tokPtr };
+                m_pending << pending;
+                tokPtr += bodyLen;
+                break; }
+            case TokTestDef:
+            case TokReplaceDef: {
+                const int name = addKey(QMakeEvaluator::getHashStr(m_pro, tokPtr));
+                const uint bodyLen = QMakeEvaluator::getBlockLen(tokPtr);
+                const int instr = emit(tok, name, tokPtr - m_base);
+                const Pending pending = { instr, -1, tokPtr };
+                m_pending << pending;
+                tokPtr += bodyLen;
+                break; }
+            case TokTestCall: {
+                const int func_t = literalName < 0
+                        ? 0 : statics.functions.value(m_code->keys.at(literalName));
+                const int instr = emit(tok, literalName, func_t);
+                arguments(tokPtr);
+                m_code->instrs[instr].next = m_code->instrs.size();
+                break; }
+            case TokCondition:
+            case TokReturn:
+            case TokBreak:
+            case TokNext:
+            case TokNot:
+            case TokAnd:
+            case TokOr:
+                emit(tok);
+                if (tok == TokNot || tok == TokAnd || tok == TokOr)
+                    continue; // The name of a test may still follow
+                break;
+            default: {
+                const ushort *exprPtr = --tokPtr;
+                const int first = m_code->instrs.size();
+                expression(tokPtr);
+                Q_ASSERT_X(tokPtr != exprPtr, "CodeCompiler", "unexpected item type");
+                if (tokPtr == exprPtr) { // Not reached with streams from QMakeParser
+                    ++tokPtr;
+                    break;
+                }
+                const ProCodeInstr &instr = m_code->instrs.at(first);
+                literalName = (!afterExpression && m_code->instrs.size() == first + 1
+                               && (instr.tok & TokMask) == TokHashLiteral) ? instr.a : -1;
+                afterExpression = true;
+                continue; }
+            }
+            literalName = -1;
+            afterExpression = false;
+        }
+    }
+
+    // Emits the instructions of an expression, without its terminator.
+    void expression(const ushort *&tokPtr)
+    {
+        forever {
+            const ushort tok = *tokPtr;
+            switch (tok & TokMask) {
+            case TokLine:
+                ++tokPtr;
+                emit(tok, *tokPtr++);
+                break;
+            case TokLiteral: {
+                ++tokPtr;
+                m_code->strings << QMakeEvaluator::getStr(m_pro, tokPtr);
+                emit(tok, m_code->strings.size() - 1);
+                break; }
+            case TokHashLiteral:
+            case TokProperty:
+                ++tokPtr;
+                emit(tok, addKey(QMakeEvaluator::getHashStr(m_pro, tokPtr)));
+                break;
+            case TokVariable: {
+                ++tokPtr;
+                const ProKey name = QMakeEvaluator::getHashStr(m_pro, tokPtr);
+                const int key = addKey(name);
+                // Deprecated names are mapped at run time, which also emits the warning.
+                emit(tok, key, statics.varMap.contains(name) ? -1 : key);
+                break; }
+            case TokEnvVar:
+                ++tokPtr;
+                m_code->strings << QMakeEvaluator::getStr(m_pro, tokPtr);
+                emit(tok, m_code->strings.size() - 1);
+                break;
+            case TokFuncName: {
+                ++tokPtr;
+                const ProKey name = QMakeEvaluator::getHashStr(m_pro, tokPtr);
+                const int instr = emit(tok, addKey(name), statics.expands.value(name));
+                arguments(tokPtr);
+                m_code->instrs[instr].next = m_code->instrs.size();
+                break; }
+            default:
+                return;
+            }
+        }
+    }
+
+    // Emits the arguments of a function call, including the separators and the terminator.
+    void arguments(const ushort *&tokPtr)
+    {
+        forever {
+            expression(tokPtr);
+            const ushort tok = *tokPtr++;
+            emit(tok);
+            if (tok == TokFuncTerminator)
+                break;
+            Q_ASSERT(tok == TokArgSeparator);
+        }
+    }
+
+    ProFile *m_pro;
+    const ushort *m_base;
+    ProCode *m_code;
+    QVector<Pending> m_pending;
+};
+
+} // namespace
+
+void QMakeEvaluator::setBytecodeEnabled(bool enable)
+{
+    bytecodeEnabled = enable;
+}
+
+// Returns the lowered form of pro if it is worth having.
+const ProCode *QMakeEvaluator::compiledCode(ProFile *pro)
+{
+    if (!bytecodeEnabled)
+        return 0;
+    if (const ProCode *code = pro->code())
+        return code;
+    if (pro->visits() < CompileThreshold)
+        return 0;
+    return pro->setCode(CodeCompiler(pro).compile());
+}
+
+// The commands of the $$system() calls in pro whose command is a single literal, except for
+// the ones in function definitions: those run in the directory of the calling project. The file
+// is lowered for that if it was not yet, unless lowering is disabled.
+QStringList QMakeEvaluator::literalCommands(ProFile *pro)
+{
+    if (!bytecodeEnabled)
+        return QStringList();
+    const ProCode *code = pro->code();
+    if (!code)
+        code = pro->setCode(CodeCompiler(pro).compile());
+    QStringList commands;
+    const QVector<ProCodeInstr> &instrs = code->instrs;
+    QVector<int> blocks(1, 0);
+    while (!blocks.isEmpty()) {
+        for (int i = blocks.takeLast(); instrs.at(i).tok != TokTerminator; ++i) {
+            const ProCodeInstr &instr = instrs.at(i);
+            if (instr.tok == TokBranch) {
+                if (instr.a >= 0)
+                    blocks << instr.a;
+                if (instr.b >= 0)
+                    blocks << instr.b;
+                continue;
+            }
+            if (instr.tok == TokForLoop) {
+                blocks << code->entries.value(instr.b);
+                continue;
+            }
+            if ((instr.tok & TokMask) != TokFuncName || !instr.b
+                    || code->keys.at(instr.a) != "system") {
+                continue;
+            }
+            const ProCodeInstr &arg = instrs.at(i + 1);
+            const ushort next = instrs.at(i + 2).tok;
+            if (next != TokArgSeparator && next != TokFuncTerminator)
+                continue;
+            if ((arg.tok & TokMask) == TokLiteral)
+                commands << code->strings.at(arg.a).toQString();
+            else if ((arg.tok & TokMask) == TokHashLiteral)
+                commands << code->keys.at(arg.a).toQString();
+        }
+    }
+    commands.removeDuplicates();
+    return commands;
+}
+
+QMakeEvaluator::VisitReturn QMakeEvaluator::visitCode(const ProCode &code, int pc)
+{
+    traceMsg("entering compiled block");
+    ProStringList curr;
+    bool okey = true, or_op = false, invert = false;
+    forever {
+        const ProCodeInstr &instr = code.instrs.at(pc++);
+        VisitReturn ret;
+        switch (instr.tok) {
+        case TokTerminator:
+            traceMsg("leaving compiled block, okey=%s", dbgBool(okey));
+            return returnBool(okey);
+        case TokLine:
+            m_current.line = instr.a;
+            continue;
+        case TokAssign:
+        case TokAppend:
+        case TokAppendUnique:
+        case TokRemove:
+        case TokReplace:
+            if (curr.size() != 1) {
+                pc = instr.next;
+                evalError(fL1S("Left hand side of assignment must expand to exactly one word."));
+            } else {
+                const ProKey &varName = map(curr.first());
+                ProStringList varVal = expandCodeReferences(code, pc, instr.a,
+                                                            instr.tok == TokReplace);
+                applyVariableOperation(instr.tok, varName, varVal);
+            }
+            curr.clear();
+            continue;
+        case TokBranch:
+            if (okey) {
+                traceMsg("taking 'then' branch");
+                ret = instr.a >= 0 ? visitCode(code, instr.a) : ReturnTrue;
+                traceMsg("finished 'then' branch");
+            } else {
+                traceMsg("taking 'else' branch");
+                ret = instr.b >= 0 ? visitCode(code, instr.b) : ReturnTrue;
+                traceMsg("finished 'else' branch");
+            }
+            okey = true, or_op = false; // force next evaluation
+            break;
+        case TokForLoop:
+            if (okey != or_op) {
+                const ProKey variable = instr.a >= 0 ? code.keys.at(instr.a) : ProKey();
+                const ProString it_list = expandCodeReferences(code, pc, 0, true).at(0);
+                ret = visitProLoop(variable, it_list, m_current.pro->tokPtr() + instr.b);
+            } else {
+                traceMsg("skipped loop");
+                ret = ReturnTrue;
+            }
+            pc = instr.next;
+            okey = true, or_op = false; // force next evaluation
+            break;
+        case TokTestDef:
+        case TokReplaceDef:
+            if (okey != or_op) {
+                const ProKey &name = code.keys.at(instr.a);
+                visitProFunctionDef(instr.tok, name, m_current.pro->tokPtr() + instr.b);
+                traceMsg("defined %s function %s",
+                      instr.tok == TokTestDef ? "test" : "replace", dbgKey(name));
+            } else {
+                traceMsg("skipped function definition");
+            }
+            okey = true, or_op = false; // force next evaluation
+            continue;
+        case TokNot:
+            traceMsg("NOT");
+            invert ^= true;
+            continue;
+        case TokAnd:
+            traceMsg("AND");
+            or_op = false;
+            continue;
+        case TokOr:
+            traceMsg("OR");
+            or_op = true;
+            continue;
+        case TokCondition:
+            if (okey != or_op) {
+                if (curr.size() != 1) {
+                    evalError(fL1S("Conditional must expand to exactly one word."));
+                    okey = false;
+                } else {
+                    okey = isActiveConfig(curr.at(0).toQString(m_tmp2), true);
+                    traceMsg("condition %s is %s", dbgStr(curr.at(0)), dbgBool(okey));
+                    okey ^= invert;
+                }
+            } else {
+                traceMsg("skipped condition %s", curr.size() == 1 ? dbgStr(curr.at(0)) : "<invalid>");
+            }
+            or_op = !okey; // tentatively force next evaluation
+            invert = false;
+            curr.clear();
+            continue;
+        case TokTestCall:
+            if (okey != or_op) {
+                if (curr.size() != 1) {
+                    evalError(fL1S("Test name must expand to exactly one word."));
+                    pc = instr.next;
+                    okey = false;
+                } else {
+                    traceMsg("evaluating test function %s", dbgStr(curr.at(0)));
+                    ret = evaluateConditionalFunction(curr.at(0).toKey(), code, pc);
+                    switch (ret) {
+                    case ReturnTrue: okey = true; break;
+                    case ReturnFalse: okey = false; break;
+                    default:
+                        traceMsg("aborting block, function status: %s", dbgReturn(ret));
+                        return ret;
+                    }
+                    traceMsg("test function returned %s", dbgBool(okey));
+                    okey ^= invert;
+                }
+            } else {
+                pc = instr.next;
+                traceMsg("skipped test function %s", curr.size() == 1 ? dbgStr(curr.at(0)) : "<invalid>");
+            }
+            or_op = !okey; // tentatively force next evaluation
+            invert = false;
+            curr.clear();
+            continue;
+        case TokReturn:
+            m_returnValue = curr;
+            curr.clear();
+            ret = ReturnReturn;
+            goto ctrlstm;
+        case TokBreak:
+            ret = ReturnBreak;
+            goto ctrlstm;
+        case TokNext:
+            ret = ReturnNext;
+          ctrlstm:
+            if (okey != or_op) {
+                traceMsg("flow control statement '%s', aborting block", dbgReturn(ret));
+                return ret;
+            }
+            traceMsg("skipped flow control statement '%s'", dbgReturn(ret));
+            okey = false, or_op = true; // force next evaluation
+            continue;
+        default:
+            evaluateCodeExpression(code, --pc, &curr, false);
+            continue;
+        }
+        if (ret != ReturnTrue && ret != ReturnFalse) {
+            traceMsg("aborting compiled block, status: %s", dbgReturn(ret));
+            return ret;
+        }
+    }
+}
+
+void QMakeEvaluator::evaluateCodeExpression(
+        const ProCode &code, int &pc, ProStringList *ret, bool joined)
+{
+    if (joined)
+        *ret << ProString();
+    bool pending = false;
+    forever {
+        const ProCodeInstr &instr = code.instrs.at(pc);
+        if (instr.tok & TokNewStr)
+            pending = false;
+        switch (instr.tok & TokMask) {
+        case TokLine:
+            m_current.line = instr.a;
+            break;
+        case TokLiteral:
+            addStr(code.strings.at(instr.a), ret, pending, joined);
+            break;
+        case TokHashLiteral:
+            addStr(code.keys.at(instr.a), ret, pending, joined);
+            break;
+        case TokVariable: {
+            const ProKey &var = instr.b >= 0 ? code.keys.at(instr.b) : map(code.keys.at(instr.a));
+            addStrList(values(var), instr.tok, ret, pending, joined);
+            break; }
+        case TokProperty:
+            addStr(propertyValue(code.keys.at(instr.a)), ret, pending, joined);
+            break;
+        case TokEnvVar: {
+            const ProString &var = code.strings.at(instr.a);
+            addStrList(split_value_list(getEnv(var.toQString(m_tmp1))), instr.tok,
+                       ret, pending, joined);
+            break; }
+        case TokFuncName:
+            addStrList(evaluateExpandFunction(code, pc), instr.tok, ret, pending, joined);
+            continue; // pc is past the arguments already
+        default:
+            return;
+        }
+        ++pc;
+    }
+}
+
+ProStringList QMakeEvaluator::expandCodeReferences(
+        const ProCode &code, int &pc, int sizeHint, bool joined)
+{
+    ProStringList ret;
+    ret.reserve(sizeHint);
+    forever {
+        evaluateCodeExpression(code, pc, &ret, joined);
+        switch (code.instrs.at(pc).tok) {
+        case TokValueTerminator:
+        case TokFuncTerminator:
+            pc++;
+            return ret;
+        case TokArgSeparator:
+            if (joined) {
+                pc++;
+                continue;
+            }
+            // fallthrough
+        default:
+            Q_ASSERT_X(false, "expandCodeReferences", "Unrecognized instruction");
+            break;
+        }
+    }
+}
+
+QList<ProStringList> QMakeEvaluator::prepareCodeArgs(const ProCode &code, int &pc)
+{
+    QList<ProStringList> args_list;
+    if (code.instrs.at(pc).tok != TokFuncTerminator) {
+        for (;; pc++) {
+            ProStringList arg;
+            evaluateCodeExpression(code, pc, &arg, false);
+            args_list << arg;
+            if (code.instrs.at(pc).tok == TokFuncTerminator)
+                break;
+            Q_ASSERT(code.instrs.at(pc).tok == TokArgSeparator);
+        }
+    }
+    pc++;
+    return args_list;
+}
+
+// pc is at the TokFuncName instruction.
+ProStringList QMakeEvaluator::evaluateExpandFunction(const ProCode &code, int &pc)
+{
+    const ProCodeInstr &instr = code.instrs.at(pc++);
+    const ProKey &func = code.keys.at(instr.a);
+    if (int func_t = instr.b) {
+        const ProStringList args = expandCodeReferences(code, pc, 5, true);
+        m_handler->aboutToCallBuiltin(func);
+        ProStringList ret = evaluateBuiltinExpand(func_t, func, args);
+        m_handler->doneWithBuiltin(func);
+        return ret;
+    }
+
+    QHash<ProKey, ProFunctionDef>::ConstIterator it =
+            m_functionDefs.replaceFunctions.constFind(func);
+    if (it != m_functionDefs.replaceFunctions.constEnd()) {
+        const QList<ProStringList> args = prepareCodeArgs(code, pc);
+        traceMsg("calling $$%s(%s)", dbgKey(func), dbgStrListList(args));
+        return evaluateFunction(*it, args, 0);
+    }
+
+    pc = instr.next;
+    evalError(fL1S("'%1' is not a recognized replace function.").arg(func.toQString(m_tmp1)));
+    return ProStringList();
+}
+
+// pc is past the TokTestCall instruction.
+QMakeEvaluator::VisitReturn QMakeEvaluator::evaluateConditionalFunction(
+        const ProKey &func, const ProCode &code, int &pc)
+{
+    const ProCodeInstr &instr = code.instrs.at(pc - 1);
+    int func_t;
+    if (instr.a >= 0)
+        func_t = instr.b;
+    else if (ushort atom = func.atom())
+        func_t = atom < statics.functionsByAtom.size() ? statics.functionsByAtom.at(atom) : 0;
+    else
+        func_t = statics.functions.value(func);
+    if (func_t) {
+        const ProStringList args = expandCodeReferences(code, pc, 5, true);
+        m_handler->aboutToCallBuiltin(func);
+        const VisitReturn ret = evaluateBuiltinConditional(func_t, func, args);
+        m_handler->doneWithBuiltin(func);
+        return ret;
+    }
+
+    QHash<ProKey, ProFunctionDef>::ConstIterator it =
+            m_functionDefs.testFunctions.constFind(func);
+    if (it != m_functionDefs.testFunctions.constEnd()) {
+        const QList<ProStringList> args = prepareCodeArgs(code, pc);
+        traceMsg("calling %s(%s)", dbgKey(func), dbgStrListList(args));
+        return evaluateBoolFunction(*it, args, func);
+    }
+
+    pc = instr.next;
+    evalError(fL1S("'%1' is not a recognized test function.").arg(func.toQString(m_tmp1)));
+    return ReturnFalse;
+}
+
 QT_END_NAMESPACE
@@ -15,7 +15,9 @@
 
 #include <qlist.h>
 #include <qlinkedlist.h>
+#include <qregexp.h>
 #include <qset.h>
+#include <qsharedpointer.h>
 #include <qstack.h>
 #include <qstring.h>
 #include <qstringlist.h>
@@ -26,6 +28,9 @@
 QT_BEGIN_NAMESPACE
 
 class QMakeGlobals;
+class QMakeFeatureIndex;
+class QMakeBaseEnv;
+class QDataStream;
 
 class QMAKE_EXPORT QMakeHandler : public QMakeParserHandler
 {
@@ -45,17 +50,75 @@ public:
     enum EvalFileType { EvalProjectFile, EvalIncludeFile, EvalConfigFile, EvalFeatureFile, EvalAuxFile };
     virtual void aboutToEval(ProFile *parent, ProFile *proFile, EvalFileType type) = 0;
     virtual void doneWithEval(ProFile *parent) = 0;
+
+    // Paths the result depends on besides the evaluated files, e.g. from exists() and files().
+    // For DependEnvironment, path is the name of the variable read. DependVolatile marks
+    // inputs which cannot be checked later, like the output of commands.
+    enum DependencyType { DependFileContents, DependFileExistence, DependDirectoryContents,
+                          DependEnvironment, DependVolatile };
+    virtual void dependsOn(DependencyType type, const QString &path)
+        { Q_UNUSED(type); Q_UNUSED(path); }
+
+    // Bracket getting a file from the parser and calls of builtin functions, for profiling
+    virtual void aboutToParse(const QString &fileName) { Q_UNUSED(fileName); }
+    virtual void doneWithParse(const QString &fileName) { Q_UNUSED(fileName); }
+    virtual void aboutToCallBuiltin(const ProKey &function) { Q_UNUSED(function); }
+    virtual void doneWithBuiltin(const ProKey &function) { Q_UNUSED(function); }
 };
 
 // We use a QLinkedList based stack instead of a QVector based one (QStack), so that
 // the addresses of value maps stay constant. The qmake generators rely on that.
+// The frames are additionally indexed for random access; the list is never left shared
+// with a copy, so the indexed addresses do not change either.
 class QMAKE_EXPORT ProValueMapStack : public QLinkedList<ProValueMap>
 {
 public:
-    inline void push(const ProValueMap &t) { append(t); }
-    inline ProValueMap pop() { return takeLast(); }
+    ProValueMapStack() : m_lastSerial(0) {}
+    ProValueMapStack(const ProValueMapStack &other)
+        : QLinkedList<ProValueMap>(other), m_lastSerial(0) { indexFrames(); }
+    ProValueMapStack &operator=(const ProValueMapStack &other)
+    {
+        QLinkedList<ProValueMap>::operator=(other);
+        indexFrames();
+        return *this;
+    }
+
+    inline void push(const ProValueMap &t)
+        { append(t); m_frames << &last(); m_serials << ++m_lastSerial; }
+    inline ProValueMap pop()
+    {
+        m_frames.removeLast();
+        m_serials.removeLast();
+        // The frame below becomes the top one again and may be assigned to, which does not
+        // invalidate the scope cache. A new serial tells findOuterFrame() that it changed.
+        if (!m_serials.isEmpty())
+            m_serials.last() = ++m_lastSerial;
+        return takeLast();
+    }
     ProValueMap &top() { return last(); }
     const ProValueMap &top() const { return last(); }
+
+    // Frame 0 is the outermost one.
+    ProValueMap &frame(int i) { return *m_frames.at(i); }
+    const ProValueMap &frame(int i) const { return *m_frames.at(i); }
+    // Identifies the frame at index i. Frames pushed or exposed as the top one later have
+    // larger serials.
+    uint serial(int i) const { return m_serials.at(i); }
+
+private:
+    void indexFrames()
+    {
+        m_frames.clear();
+        m_serials.clear();
+        for (iterator it = begin(); it != end(); ++it) { // Detaches
+            m_frames << &*it;
+            m_serials << ++m_lastSerial;
+        }
+    }
+
+    QVector<ProValueMap *> m_frames;
+    QVector<uint> m_serials;
+    uint m_lastSerial;
 };
 
 class QMAKE_EXPORT QMakeEvaluator
@@ -103,8 +166,10 @@ public:
         { return b ? ReturnTrue : ReturnFalse; }
 
     static ALWAYS_INLINE uint getBlockLen(const ushort *&tokPtr);
-    ProString getStr(const ushort *&tokPtr);
-    ProKey getHashStr(const ushort *&tokPtr);
+    ProString getStr(const ushort *&tokPtr) { return getStr(m_current.pro, tokPtr); }
+    ProKey getHashStr(const ushort *&tokPtr) { return getHashStr(m_current.pro, tokPtr); }
+    static ProString getStr(ProFile *pro, const ushort *&tokPtr);
+    static ProKey getHashStr(ProFile *pro, const ushort *&tokPtr);
     void evaluateExpression(const ushort *&tokPtr, ProStringList *ret, bool joined);
     static ALWAYS_INLINE void skipStr(const ushort *&tokPtr);
     static ALWAYS_INLINE void skipHashStr(const ushort *&tokPtr);
@@ -115,6 +180,13 @@ public:
     bool loadSpecInternal();
     bool loadSpec();
     void initFrom(const QMakeEvaluator &other);
+    QString snapshotKey() const;
+    QString snapshotFileName() const;
+    QString dependencyStamp(int type, const QString &path) const;
+    QStringList baseEnvStamps(const QMakeBaseEnv &baseEnv) const;
+    bool saveSnapshot(const QString &fileName, const QMakeBaseEnv &baseEnv) const;
+    bool restoreSnapshot(const QString &fileName);
+    bool readFunctionDefs(QDataStream &stream, QHash<ProKey, ProFunctionDef> *defs);
     void setupProject();
     void evaluateCommand(const QString &cmds, const QString &where);
     VisitReturn visitProFile(ProFile *pro, QMakeHandler::EvalFileType type,
@@ -123,12 +195,28 @@ public:
     VisitReturn visitProBlock(const ushort *tokPtr);
     VisitReturn visitProLoop(const ProKey &variable, const ushort *exprPtr,
                              const ushort *tokPtr);
+    VisitReturn visitProLoop(const ProKey &variable, ProString it_list, const ushort *tokPtr);
     void visitProFunctionDef(ushort tok, const ProKey &name, const ushort *tokPtr);
     void visitProVariable(ushort tok, const ProStringList &curr, const ushort *&tokPtr);
+    void applyVariableOperation(ushort tok, const ProKey &varName, ProStringList &varVal);
+
+    // Evaluation of lowered token streams, see ProCode
+    static void setBytecodeEnabled(bool enable);
+    const ProCode *compiledCode(ProFile *pro);
+    QStringList literalCommands(ProFile *pro);
+    VisitReturn visitCode(const ProCode &code, int pc);
+    void evaluateCodeExpression(const ProCode &code, int &pc, ProStringList *ret, bool joined);
+    ProStringList expandCodeReferences(const ProCode &code, int &pc, int sizeHint, bool joined);
+    QList<ProStringList> prepareCodeArgs(const ProCode &code, int &pc);
+    ProStringList evaluateExpandFunction(const ProCode &code, int &pc);
+    VisitReturn evaluateConditionalFunction(const ProKey &function, const ProCode &code, int &pc);
 
     ALWAYS_INLINE const ProKey &map(const ProString &var) { return map(var.toKey()); }
     const ProKey &map(const ProKey &var);
     ProValueMap *findValues(const ProKey &variableName, ProValueMap::Iterator *it);
+    int findOuterFrame(const ProKey &variableName, ProValueMap::ConstIterator *it) const;
+    // Call after adding variables to or removing them from frames other than the top one.
+    void invalidateScopeCache() { ++m_scopeGeneration; }
 
     void setTemplate();
 
@@ -141,6 +229,16 @@ public:
     ProFile *currentProFile() const;
     QString resolvePath(const QString &fileName) const
         { return QMakeInternal::IoUtils::resolvePath(currentDirectory(), fileName); }
+    QMakeInternal::FileTypeCache *fileTypeCache() const;
+    QMakeInternal::IoUtils::FileType fileType(const QString &fileName) const
+        { return fileTypeCache()->fileType(fileName); }
+    bool exists(const QString &fileName) const
+        { return fileTypeCache()->exists(fileName); }
+    // Reports to the handler, and records for the baseline being loaded.
+    void dependsOn(QMakeHandler::DependencyType type, const QString &path) const;
+    // Like the ones of QMakeGlobals, but the variables read are reported as dependencies.
+    QString getEnv(const QString &var) const;
+    QString expandEnvVars(const QString &str) const;
 
     VisitReturn evaluateFile(const QString &fileName, QMakeHandler::EvalFileType type,
                              LoadFlags flags);
@@ -181,6 +279,11 @@ public:
     void updateFeaturePaths();
 
     bool isActiveConfig(const QString &config, bool regex = false);
+    int lastActiveConfig(const QStringList &mutuals);
+    struct ConfigIndex;
+    ConfigIndex &configIndex();
+    bool detachConfigIndex();
+    void updateConfigIndex(ushort tok, const ProStringList &varVal);
 
     void populateDeps(
             const ProStringList &deps, const ProString &prefix,
@@ -191,12 +294,40 @@ public:
                           const QString &contents);
 #ifndef QT_BOOTSTRAPPED
     void runProcess(QProcess *proc, const QString &command) const;
+    static void runProcess(QProcess *proc, const QString &command, const QString &dir,
+                           const QMakeGlobals *option);
+    static QString commandKey(const QString &command, const QString &dir,
+                              const QMakeGlobals *option);
+# ifdef PROEVALUATOR_THREAD_SAFE
+    void prefetchCommands(ProFile *pro);
+# endif
 #endif
+    // The outputs are cached, see QMakeGlobals::claimCommandOutput().
     QByteArray getCommandOutput(const QString &args) const;
 
     static void removeEach(ProStringList *varlist, const ProStringList &value);
 
+    // Compiled patterns are cached process-wide, so loops do not recompile them.
+    static QRegExp compiledPattern(const QString &pattern,
+                                   QRegExp::PatternSyntax syntax = QRegExp::RegExp,
+                                   Qt::CaseSensitivity cs = Qt::CaseSensitive);
+    static void patternCacheStats(qint64 *hits, qint64 *misses);
+    static void expandMemoStats(qint64 *hits, qint64 *misses);
+
+    // Demand-driven evaluation, see qmakedemand.cpp. Statements which cannot contribute to
+    // the target variables are skipped. If a skipped variable is read nevertheless, the
+    // values of the evaluation are unreliable and it must be repeated without targets.
+    void setTargetVariables(const ProStringList &names);
+    bool skippedVariablesRead() const;
+    struct DemandState;
+    void analyzeDemand(ProFile *pro);
+    const ushort *irrelevantStatementEnd(const ushort *tokPtr, bool *branch);
+    void noteVariableRead(const ProKey &variableName) const;
+
     QMakeEvaluator *m_caller;
+    // If set, the baseline being loaded, which receives the names of all evaluated files and
+    // everything else the evaluation depends on
+    QMakeBaseEnv *m_baseEnv;
 #ifdef PROEVALUATOR_CUMULATIVE
     bool m_cumulative;
     int m_skipLevel;
@@ -252,13 +383,47 @@ public:
     QStringList m_qmakefeatures;
     QStringList m_mkspecPaths;
     QStringList m_featureRoots;
+    QSharedPointer<const QMakeFeatureIndex> m_featureIndex; // Of m_featureRoots, built lazily
     ProString m_dirSep;
     ProFunctionDefs m_functionDefs;
     ProStringList m_returnValue;
     ProValueMapStack m_valuemapStack; // VariableName must be us-ascii, the content however can be non-us-ascii.
+    // Which outer frame defined a variable when it was last looked up, see findOuterFrame().
+    struct ScopeLookup
+    {
+        ScopeLookup() : frames(0), serial(0), generation(0), frame(-1) {}
+
+        int frames; // The number of frames below the top one at the time
+        uint serial; // The serial of the innermost of them
+        uint generation;
+        int frame; // -1 if none of them defined the variable
+    };
+    mutable QHash<ProKey, ScopeLookup> m_scopeCache;
+    uint m_scopeGeneration;
+    // Membership index of CONFIG, for scope conditions. It shares the data of the list it was
+    // built from, so any modification of CONFIG detaches the list and thereby shows up as a
+    // different data pointer. Simple assignments to CONFIG update the index instead.
+    struct ConfigIndex
+    {
+        ConfigIndex() : nextPosition(0), valid(false) {}
+
+        ProStringList values;
+        // Where every value occurs last. Only the order of the positions is meaningful,
+        // so removing values does not require renumbering the others.
+        QHash<ProString, int> lastPosition;
+        QHash<QString, bool> wildcards; // Results of wildcard tests, for specName
+        QString specName;
+        int nextPosition;
+        bool valid;
+    };
+    ConfigIndex m_configIndex;
+    // Used unless QMakeGlobals provides a cache, and shared with nested evaluators.
+    mutable QMakeInternal::FileTypeCache m_fileTypeCache;
     QString m_tmp1, m_tmp2, m_tmp3, m_tmp[2]; // Temporaries for efficient toQString
     mutable QString m_mtmp;
 
+    QSharedPointer<DemandState> m_demand; // Set in demand-driven mode
+
     QMakeGlobals *m_option;
     QMakeParser *m_parser;
     QMakeHandler *m_handler;
@@ -9,6 +9,7 @@
 #include "proitems.h"
 
 #include <qregexp.h>
+#include <qvector.h>
 
 #define debugMsg if (!m_debugLevel) {} else debugMsgInternal
 #define traceMsg if (!m_debugLevel) {} else traceMsgInternal
@@ -58,6 +59,10 @@ struct QMakeStatics {
 #endif
     QHash<ProKey, int> expands;
     QHash<ProKey, int> functions;
+    // The same, indexed by ProKey::atom(). The builtins are interned during
+    // initialization, so names with larger atoms are not builtins.
+    QVector<int> expandsByAtom;
+    QVector<int> functionsByAtom;
     QHash<ProKey, ProKey> varMap;
     ProStringList fakeValue;
 };
@@ -7,8 +7,11 @@
 
 #include "qmakeevaluator.h"
 #include "ioutils.h"
+#include "qmakecachefile.h"
 
 #include <qbytearray.h>
+#include <qcryptographichash.h>
+#include <qdatastream.h>
 #include <qdatetime.h>
 #include <qdebug.h>
 #include <qdir.h>
@@ -16,6 +19,7 @@
 #include <qfileinfo.h>
 #include <qlist.h>
 #include <qregexp.h>
+#include <qsavefile.h>
 #include <qset.h>
 #include <qstack.h>
 #include <qstring.h>
@@ -68,6 +72,10 @@ QMakeGlobals::QMakeGlobals()
     initStatics();
 
     do_cache = true;
+    file_type_cache = 0;
+    command_cache_ttl = 0;
+    prefetch_commands = false;
+    commandHits = commandRuns = 0;
 
 #ifdef PROEVALUATOR_DEBUG
     debugLevel = 0;
@@ -87,6 +95,192 @@ QMakeGlobals::~QMakeGlobals()
     qDeleteAll(baseEnvs);
 }
 
+#ifdef Q_OS_WIN
+// Feature file names are matched like the file system does.
+# define FEATURE_KEY(name) (name).toLower()
+#else
+# define FEATURE_KEY(name) (name)
+#endif
+
+QMakeFeatureIndex::QMakeFeatureIndex(const QStringList &_roots,
+                                     QMakeInternal::FileTypeCache *cache)
+    : roots(_roots)
+{
+    for (int root = 0; root < roots.size(); ++root) {
+        const QVector<QMakeInternal::IoUtils::DirEntry> entries =
+                cache->directoryEntries(roots.at(root));
+        foreach (const QMakeInternal::IoUtils::DirEntry &entry, entries) {
+            if (entry.type == QMakeInternal::IoUtils::FileIsRegular
+                    && entry.name.endsWith(QLatin1String(".prf"))) {
+                files[FEATURE_KEY(entry.name)] << root;
+            }
+        }
+    }
+}
+
+QVector<int> QMakeFeatureIndex::find(const QString &fileName) const
+{
+    return files.value(FEATURE_KEY(fileName));
+}
+
+QSharedPointer<const QMakeFeatureIndex> QMakeGlobals::featureIndex(
+        const QStringList &roots, QMakeInternal::FileTypeCache *cache)
+{
+    const QString key = roots.join(QLatin1Char('\n'));
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&mutex);
+#endif
+    QSharedPointer<const QMakeFeatureIndex> &index = featureIndexes[key];
+    if (!index)
+        index = QSharedPointer<const QMakeFeatureIndex>(new QMakeFeatureIndex(roots, cache));
+    return index;
+}
+
+void QMakeGlobals::discardFeatureIndexes()
+{
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&mutex);
+#endif
+    featureIndexes.clear();
+}
+
+void QMakeGlobals::recheckBaseEnvs()
+{
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&mutex);
+#endif
+    foreach (QMakeBaseEnv *baseEnv, baseEnvs) {
+#ifdef PROEVALUATOR_THREAD_SAFE
+        QMutexLocker baseLocker(&baseEnv->mutex);
+#endif
+        baseEnv->checked = false;
+    }
+}
+
+enum { CommandCacheMagic = 0x51434d44, CommandCacheVersion = 1 }; // "QCMD"
+
+QString QMakeGlobals::commandCacheFileName(const QString &key) const
+{
+    if (command_cache_dir.isEmpty() || command_cache_ttl <= 0)
+        return QString();
+    return QMakeInternal::cacheFileName(command_cache_dir, key, ".qcmd");
+}
+
+bool QMakeGlobals::readCommandCache(const QString &key, QMakeCommandOutput *output) const
+{
+    const QString fileName = commandCacheFileName(key);
+    if (fileName.isEmpty())
+        return false;
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream stream(&file);
+    if (!QMakeInternal::readCacheHeader(stream, CommandCacheMagic, CommandCacheVersion, key))
+        return false;
+    qint64 time;
+    stream >> time >> output->out >> output->err;
+    return stream.status() == QDataStream::Ok
+            && QDateTime::currentMSecsSinceEpoch() - time < qint64(command_cache_ttl) * 1000;
+}
+
+void QMakeGlobals::writeCommandCache(const QString &key, const QMakeCommandOutput &output) const
+{
+    const QString fileName = commandCacheFileName(key);
+    if (fileName.isEmpty())
+        return;
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+    QDataStream stream(&file);
+    QMakeInternal::writeCacheHeader(stream, CommandCacheMagic, CommandCacheVersion, key);
+    stream << QDateTime::currentMSecsSinceEpoch() << output.out << output.err;
+    file.commit();
+}
+
+bool QMakeGlobals::claimCommandOutput(const QString &key, QMakeCommandOutput *output)
+{
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&commandMutex);
+#endif
+    QHash<QString, QMakeCommandOutput>::Iterator it = commandOutputs.find(key);
+    if (it == commandOutputs.end()) {
+        // Read the disk cache without holding the lock, so that other commands can proceed.
+#ifdef PROEVALUATOR_THREAD_SAFE
+        locker.unlock();
+#endif
+        QMakeCommandOutput cached;
+        const bool found = readCommandCache(key, &cached);
+#ifdef PROEVALUATOR_THREAD_SAFE
+        locker.relock();
+#endif
+        // Another thread may have claimed it meanwhile; its entry wins then.
+        it = commandOutputs.find(key);
+        if (it == commandOutputs.end()) {
+            if (!found) {
+                commandOutputs.insert(key, QMakeCommandOutput());
+                ++commandRuns;
+                return true;
+            }
+            cached.done = true;
+            it = commandOutputs.insert(key, cached);
+        }
+    }
+    if (output) {
+#ifdef PROEVALUATOR_THREAD_SAFE
+        while (!it->done) {
+            commandCond.wait(&commandMutex);
+            // The hash may have been rehashed while waiting.
+            it = commandOutputs.find(key);
+            if (it == commandOutputs.end()) { // Discarded; run it again
+                commandOutputs.insert(key, QMakeCommandOutput());
+                ++commandRuns;
+                return true;
+            }
+        }
+#endif
+        ++commandHits;
+        *output = *it;
+        it->prefetched = false;
+    }
+    return false;
+}
+
+void QMakeGlobals::storeCommandOutput(const QString &key, const QMakeCommandOutput &output)
+{
+    writeCommandCache(key, output);
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&commandMutex);
+#endif
+    QHash<QString, QMakeCommandOutput>::Iterator it = commandOutputs.find(key);
+    if (it == commandOutputs.end() || it->done)
+        return; // Discarded meanwhile, or already stored by a concurrent run
+    *it = output;
+    it->done = true;
+#ifdef PROEVALUATOR_THREAD_SAFE
+    commandCond.wakeAll();
+#endif
+}
+
+void QMakeGlobals::discardCommandOutputs()
+{
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&commandMutex);
+#endif
+    commandOutputs.clear();
+#ifdef PROEVALUATOR_THREAD_SAFE
+    commandCond.wakeAll();
+#endif
+}
+
+void QMakeGlobals::commandOutputStats(qint64 *hits, qint64 *runs)
+{
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutexLocker locker(&commandMutex);
+#endif
+    *hits = commandHits;
+    *runs = commandRuns;
+}
+
 QString QMakeGlobals::cleanSpec(QMakeCmdLineParserState &state, const QString &spec)
 {
     QString ret = QDir::cleanPath(spec);
@@ -258,37 +452,112 @@ QStringList QMakeGlobals::getPathListEnv(const QString &var) const
     return ret;
 }
 
-QString QMakeGlobals::expandEnvVars(const QString &str) const
+QString QMakeGlobals::expandEnvVars(const QString &str, QStringList *names) const
 {
     QString string = str;
     int rep;
     QRegExp reg_variableName = statics.reg_variableName; // Copy for thread safety
-    while ((rep = reg_variableName.indexIn(string)) != -1)
-        string.replace(rep, reg_variableName.matchedLength(),
-                       getEnv(string.mid(rep + 2, reg_variableName.matchedLength() - 3)));
+    while ((rep = reg_variableName.indexIn(string)) != -1) {
+        const QString name = string.mid(rep + 2, reg_variableName.matchedLength() - 3);
+        if (names)
+            *names << name;
+        string.replace(rep, reg_variableName.matchedLength(), getEnv(name));
+    }
     return string;
 }
 
 #ifndef QT_BUILD_QMAKE
-#ifdef PROEVALUATOR_INIT_PROPS
-bool QMakeGlobals::initProperties()
+enum { PropertyCacheMagic = 0x51505259, PropertyCacheVersion = 2 }; // "QPRY"
+
+// Everything the output of qmake -query depends on, except for the properties
+// set with qmake -set, which need an explicit discardCachedProperties().
+static QStringList queryIdentity(const QString &qmake)
+{
+    const QFileInfo binary(qmake);
+    if (!binary.isFile())
+        return QStringList();
+    QFile file(binary.absoluteFilePath());
+    if (!file.open(QIODevice::ReadOnly))
+        return QStringList();
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(&file);
+    const QFileInfo conf(binary.absolutePath() + QLatin1String("/qt.conf"));
+    return QStringList()
+            << QString::number(PropertyCacheVersion) << binary.absoluteFilePath()
+            << QString::number(binary.size())
+            << QString::number(binary.lastModified().toMSecsSinceEpoch())
+            << QString::fromLatin1(hash.result().toHex())
+            << QString::number(conf.exists() ? conf.size() : -1)
+            << QString::number(conf.exists() ? conf.lastModified().toMSecsSinceEpoch() : 0);
+}
+
+QString QMakeGlobals::propertyCacheFileName(const QString &qmake) const
+{
+    if (property_cache_dir.isEmpty())
+        return QString();
+    return QMakeInternal::cacheFileName(property_cache_dir, QFileInfo(qmake).absoluteFilePath(),
+                                        ".qpry");
+}
+
+bool QMakeGlobals::readPropertyCache(const QString &qmake, const QStringList &identity,
+                                     QByteArray *data) const
+{
+    const QString fileName = propertyCacheFileName(qmake);
+    if (fileName.isEmpty() || identity.isEmpty())
+        return false;
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream stream(&file);
+    if (!QMakeInternal::readCacheHeader(stream, PropertyCacheMagic, PropertyCacheVersion,
+                                        identity.join(QLatin1Char('\n')))) {
+        return false;
+    }
+    stream >> *data;
+    return stream.status() == QDataStream::Ok;
+}
+
+void QMakeGlobals::writePropertyCache(const QString &qmake, const QStringList &identity,
+                                      const QByteArray &data) const
+{
+    const QString fileName = propertyCacheFileName(qmake);
+    if (fileName.isEmpty())
+        return;
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+    QDataStream stream(&file);
+    QMakeInternal::writeCacheHeader(stream, PropertyCacheMagic, PropertyCacheVersion,
+                                    identity.join(QLatin1Char('\n')));
+    stream << data;
+    file.commit();
+}
+
+static bool runQuery(const QString &qmake, QByteArray *data)
 {
-    QByteArray data;
 #ifndef QT_BOOTSTRAPPED
     QProcess proc;
-    proc.start(qmake_abslocation, QStringList() << QLatin1String("-query"));
-    if (!proc.waitForFinished())
+    proc.start(qmake, QStringList() << QLatin1String("-query"));
+    if (!proc.waitForFinished() || proc.exitStatus() != QProcess::NormalExit
+            || proc.exitCode() != 0) {
         return false;
-    data = proc.readAll();
+    }
+    *data = proc.readAll();
+    return true;
 #else
-    if (FILE *proc = QT_POPEN(QString(QMakeInternal::IoUtils::shellQuote(qmake_abslocation)
+    if (FILE *proc = QT_POPEN(QString(QMakeInternal::IoUtils::shellQuote(qmake)
                                       + QLatin1String(" -query")).toLocal8Bit(), "r")) {
         char buff[1024];
         while (!feof(proc))
-            data.append(buff, int(fread(buff, 1, 1023, proc)));
-        QT_PCLOSE(proc);
+            data->append(buff, int(fread(buff, 1, 1023, proc)));
+        return QT_PCLOSE(proc) == 0;
     }
+    return false;
 #endif
+}
+
+void QMakeGlobals::parseProperties(const QByteArray &data)
+{
     foreach (QByteArray line, data.split('\n'))
         if (!line.startsWith("QMAKE_")) {
             int off = line.indexOf(':');
@@ -317,8 +586,48 @@ bool QMakeGlobals::initProperties()
             }
         }
     properties.insert(ProKey("QMAKE_VERSION"), ProString("2.01a"));
+}
+
+bool QMakeGlobals::loadCachedProperties(const QString &qmake, QString *identity)
+{
+    const QStringList id = queryIdentity(qmake);
+    QByteArray data;
+    if (!readPropertyCache(qmake, id, &data))
+        return false;
+    parseProperties(data);
+    if (identity)
+        *identity = id.join(QLatin1Char('\n'));
+    return true;
+}
+
+bool QMakeGlobals::queryProperties(const QString &qmake, QString *identity)
+{
+    const QStringList id = queryIdentity(qmake);
+    QByteArray data;
+    if (!readPropertyCache(qmake, id, &data)) {
+        if (!runQuery(qmake, &data))
+            return false;
+        if (!id.isEmpty())
+            writePropertyCache(qmake, id, data);
+    }
+    parseProperties(data);
+    if (identity)
+        *identity = id.join(QLatin1Char('\n'));
     return true;
 }
+
+void QMakeGlobals::discardCachedProperties(const QString &qmake)
+{
+    const QString fileName = propertyCacheFileName(qmake);
+    if (!fileName.isEmpty())
+        QFile::remove(fileName);
+}
+
+#ifdef PROEVALUATOR_INIT_PROPS
+bool QMakeGlobals::initProperties()
+{
+    return queryProperties(qmake_abslocation);
+}
 #else
 void QMakeGlobals::setProperties(const QHash<QString, QString> &props)
 {
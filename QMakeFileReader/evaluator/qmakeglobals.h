@@ -8,18 +8,23 @@
 
 #include "qmake_global.h"
 #include "proitems.h"
+#include "ioutils.h"
 
 #ifdef QT_BUILD_QMAKE
 #  include <property.h>
 #endif
 
 #include <qhash.h>
+#include <qpair.h>
+#include <qsharedpointer.h>
 #include <qstringlist.h>
+#include <qvector.h>
 #ifndef QT_BOOTSTRAPPED
 # include <qprocess.h>
 #endif
 #ifdef PROEVALUATOR_THREAD_SAFE
 # include <qmutex.h>
+# include <qthreadpool.h>
 # include <qwaitcondition.h>
 #endif
 
@@ -54,6 +59,38 @@ public:
     bool isOk;
 #endif
     QMakeEvaluator *evaluator;
+    QStringList files; // The files the baseline was loaded from
+    // Everything else it depends on, by QMakeHandler::DependencyType
+    QVector<QPair<int, QString> > dependencies;
+    QStringList stamps; // The state of the files and dependencies when it was loaded
+    bool checked; // The stamps were compared since recheckBaseEnvs()
+};
+
+// The feature files present in a list of feature roots, so loading a feature
+// does not probe every root.
+class QMakeFeatureIndex
+{
+public:
+    // The roots are listed through cache.
+    QMakeFeatureIndex(const QStringList &_roots, QMakeInternal::FileTypeCache *cache);
+
+    // The indexes of the roots containing fileName, in ascending order.
+    QVector<int> find(const QString &fileName) const;
+
+    QStringList roots;
+
+private:
+    QHash<QString, QVector<int> > files;
+};
+
+// The output of a command run by $$system().
+struct QMakeCommandOutput
+{
+    QMakeCommandOutput() : done(false), prefetched(false) {}
+
+    QByteArray out, err;
+    bool done; // The command is still running otherwise
+    bool prefetched; // Run speculatively, and not consumed by an evaluation yet
 };
 
 class QMAKE_EXPORT QMakeCmdLineParserState
@@ -79,6 +116,20 @@ public:
     QProcessEnvironment environment;
 #endif
     QString qmake_abslocation;
+    // If set, evaluated mkspec baselines are persisted here (see QMakeEvaluator::saveSnapshot())
+    QString snapshot_dir;
+    // If set, the output of qmake -query is kept here, keyed by the identity of the binary
+    QString property_cache_dir;
+    // If set, shared by all evaluations instead of giving each one a cache of its own.
+    // The caller owns it and must clear it when the file system may have changed.
+    QMakeInternal::FileTypeCache *file_type_cache;
+    // If set and command_cache_ttl is positive, the outputs of $$system() are also persisted
+    // here, and reused by later sessions for that many seconds.
+    QString command_cache_dir;
+    int command_cache_ttl;
+    // If set, the $$system() calls with literal commands in a file are started concurrently
+    // before the file is evaluated.
+    bool prefetch_commands;
 
     QString qmakespec, xqmakespec;
     QString user_template, user_template_prefix;
@@ -99,6 +150,11 @@ public:
     void setQMakeProperty(QMakeProperty *prop) { property = prop; }
     ProString propertyValue(const ProKey &name) const { return property->value(name); }
 #else
+    // Both return the identity of the binary the properties came from, which
+    // changes whenever its output may change.
+    bool loadCachedProperties(const QString &qmake, QString *identity = 0);
+    bool queryProperties(const QString &qmake, QString *identity = 0);
+    void discardCachedProperties(const QString &qmake);
 #  ifdef PROEVALUATOR_INIT_PROPS
     bool initProperties();
 #  else
@@ -107,7 +163,22 @@ public:
     ProString propertyValue(const ProKey &name) const { return properties.value(name); }
 #endif
 
-    QString expandEnvVars(const QString &str) const;
+    // If names is given, it receives the names of the variables read.
+    QString expandEnvVars(const QString &str, QStringList *names = 0) const;
+    // Indexes are shared by all evaluations with the same feature roots.
+    QSharedPointer<const QMakeFeatureIndex> featureIndex(const QStringList &roots,
+                                                         QMakeInternal::FileTypeCache *cache);
+    void discardFeatureIndexes();
+    // Evaluated baselines are reused as they are. After this, the next evaluation using one
+    // compares its files and dependencies with their state and reloads it if any changed.
+    void recheckBaseEnvs();
+    // Command outputs are shared by all evaluations until discarded. If there is no entry for
+    // key, one is created and true is returned; the caller must then run the command and
+    // store its output. Otherwise, the output is waited for and copied to output, if given.
+    bool claimCommandOutput(const QString &key, QMakeCommandOutput *output);
+    void storeCommandOutput(const QString &key, const QMakeCommandOutput &output);
+    void discardCommandOutputs();
+    void commandOutputStats(qint64 *hits, qint64 *runs);
     QString shadowedPath(const QString &fileName) const;
 
 private:
@@ -121,6 +192,13 @@ private:
 #ifdef QT_BUILD_QMAKE
     QMakeProperty *property;
 #else
+    QString propertyCacheFileName(const QString &qmake) const;
+    bool readPropertyCache(const QString &qmake, const QStringList &identity,
+                           QByteArray *data) const;
+    void writePropertyCache(const QString &qmake, const QStringList &identity,
+                            const QByteArray &data) const;
+    void parseProperties(const QByteArray &data);
+
     QHash<ProKey, ProString> properties;
 #endif
 
@@ -128,6 +206,21 @@ private:
     QMutex mutex;
 #endif
     QHash<QMakeBaseKey, QMakeBaseEnv *> baseEnvs;
+    QHash<QString, QSharedPointer<const QMakeFeatureIndex> > featureIndexes;
+
+    QString commandCacheFileName(const QString &key) const;
+    bool readCommandCache(const QString &key, QMakeCommandOutput *output) const;
+    void writeCommandCache(const QString &key, const QMakeCommandOutput &output) const;
+
+    QHash<QString, QMakeCommandOutput> commandOutputs;
+    qint64 commandHits, commandRuns;
+#ifdef PROEVALUATOR_THREAD_SAFE
+    QMutex commandMutex;
+    QWaitCondition commandCond;
+    // Runs prefetched commands. Declared last, so that they are done before anything else
+    // is destroyed.
+    QThreadPool commandPool;
+#endif
 
     friend class QMakeEvaluator;
 };
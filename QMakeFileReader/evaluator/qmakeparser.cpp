@@ -8,11 +8,29 @@
 #include "ioutils.h"
 using namespace QMakeInternal;
 
+#include <qcryptographichash.h>
+#include <qdatetime.h>
 #include <qfile.h>
+#include <qfileinfo.h>
+#include <qsavefile.h>
 #ifdef PROPARSER_THREAD_SAFE
 # include <qthreadpool.h>
 #endif
 
+#include <qalgorithms.h>
+
+#include <limits.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define QMAKEPARSER_SSE2
+#  include <emmintrin.h>
+#  ifdef __AVX2__
+#    define QMAKEPARSER_AVX2
+#    include <immintrin.h>
+#  endif
+#endif
+
 QT_BEGIN_NAMESPACE
 
 ///////////////////////////////////////////////////////////////////////
@@ -59,6 +77,95 @@ void ProFileCache::discardFiles(const QString &prefix)
         }
 }
 
+// On-disk layout of a cached token stream. The header is followed by the file name and the
+// token stream, both as ushort arrays, so the tokens can be copied straight out of a mapping.
+// Bump the version whenever the token stream format changes.
+namespace {
+enum { DiskCacheMagic = 0x4b4f5451, DiskCacheVersion = 2 }; // "QTOK"
+enum { DiskCacheHostBuild = 1 };
+struct DiskCacheHeader {
+    quint32 magic;
+    quint32 version;
+    qint64 size;
+    qint64 mtime;
+    uchar contentHash[16];
+    quint32 flags;
+    quint32 nameLength;
+    quint32 tokenCount;
+    quint32 reserved;
+};
+}
+
+static QByteArray diskCacheContentHash(const QByteArray &content)
+{
+    return QCryptographicHash::hash(content, QCryptographicHash::Md5);
+}
+
+QString ProFileCache::diskCacheFileName(const QString &fileName) const
+{
+    return disk_cache_dir + QLatin1Char('/')
+            + QString::fromLatin1(QCryptographicHash::hash(fileName.toUtf8(),
+                                                           QCryptographicHash::Sha1).toHex())
+            + QLatin1String(".qtok");
+}
+
+bool ProFileCache::loadFromDisk(ProFile *pro, const QByteArray &content, qint64 mtime) const
+{
+    QFile file(diskCacheFileName(pro->fileName()));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const qint64 fileSize = file.size();
+    if (fileSize < qint64(sizeof(DiskCacheHeader)))
+        return false;
+    const uchar *data = file.map(0, fileSize);
+    if (!data)
+        return false;
+
+    DiskCacheHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != DiskCacheMagic || header.version != DiskCacheVersion
+            || header.size != content.size() || header.mtime != mtime
+            || fileSize != qint64(sizeof(header))
+                           + (qint64(header.nameLength) + header.tokenCount) * 2) {
+        return false;
+    }
+    const QChar *name = reinterpret_cast<const QChar *>(data + sizeof(header));
+    if (QString::fromRawData(name, header.nameLength) != pro->fileName())
+        return false;
+    // Size and time stamp may survive an edit; the content hash does not.
+    if (memcmp(header.contentHash, diskCacheContentHash(content).constData(), 16))
+        return false;
+
+    *pro->itemsRef() = QString(name + header.nameLength, header.tokenCount);
+    pro->setHostBuild(header.flags & DiskCacheHostBuild);
+    return true;
+}
+
+void ProFileCache::saveToDisk(const ProFile *pro, const QByteArray &content, qint64 mtime) const
+{
+    DiskCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = DiskCacheMagic;
+    header.version = DiskCacheVersion;
+    header.size = content.size();
+    header.mtime = mtime;
+    memcpy(header.contentHash, diskCacheContentHash(content).constData(), 16);
+    header.flags = pro->isHostBuild() ? DiskCacheHostBuild : 0;
+    const QString fileName = pro->fileName();
+    header.nameLength = fileName.size();
+    header.tokenCount = pro->items().size();
+
+    // QSaveFile renames into place, so concurrent readers never see partial entries.
+    QSaveFile file(diskCacheFileName(fileName));
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(fileName.constData()), fileName.size() * 2);
+    file.write(reinterpret_cast<const char *>(pro->items().constData()),
+               pro->items().size() * 2);
+    file.commit();
+}
+
 
 ////////// Parser ///////////
 
@@ -192,6 +299,25 @@ void QMakeParser::discardFileFromCache(const QString &fileName)
         m_cache->discardFile(fileName);
 }
 
+// Project files are nearly always plain ASCII, for which Latin-1 decoding
+// (vectorized in QtCore) gives the same result as the locale codec.
+static QString decodeContents(const QByteArray &bcont)
+{
+    const char *data = bcont.constData();
+    const int size = bcont.size();
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        quint64 chunk;
+        memcpy(&chunk, data + i, 8);
+        if (chunk & Q_UINT64_C(0x8080808080808080))
+            return QString::fromLocal8Bit(data, size);
+    }
+    for (; i < size; ++i)
+        if (data[i] & 0x80)
+            return QString::fromLocal8Bit(data, size);
+    return QString::fromLatin1(data, size);
+}
+
 bool QMakeParser::read(ProFile *pro)
 {
     QFile file(pro->fileName());
@@ -202,17 +328,37 @@ bool QMakeParser::read(ProFile *pro)
         return false;
     }
 
-    QByteArray bcont = file.readAll();
+    // The mapping stays valid as long as file exists, so the contents are not copied.
+    QByteArray bcont;
+    const qint64 size = file.size();
+    if (size > 0 && size < INT_MAX) {
+        if (const uchar *data = file.map(0, size))
+            bcont = QByteArray::fromRawData(reinterpret_cast<const char *>(data), int(size));
+    }
+    if (bcont.isNull())
+        bcont = file.readAll();
     if (bcont.startsWith(QByteArray("\xef\xbb\xbf"))) {
         // UTF-8 BOM will cause subtle errors
         m_handler->message(QMakeParserHandler::ParserIoError,
                            fL1S("Unexpected UTF-8 BOM in %1").arg(pro->fileName()));
         return false;
     }
-    QString content(QString::fromLocal8Bit(bcont));
-    bcont.clear();
-    file.close();
-    return read(pro, content, 1, FullGrammar);
+
+    const bool useDiskCache = m_cache && !m_cache->disk_cache_dir.isEmpty();
+    qint64 mtime = 0;
+    if (useDiskCache) {
+        mtime = QFileInfo(pro->fileName()).lastModified().toMSecsSinceEpoch();
+        if (m_cache->loadFromDisk(pro, bcont, mtime))
+            return true;
+    }
+
+    QString content(decodeContents(bcont));
+    if (!read(pro, content, 1, FullGrammar))
+        return false;
+    // Files with errors are parsed again, so that the errors get reported.
+    if (useDiskCache && pro->isOk())
+        m_cache->saveToDisk(pro, bcont, mtime);
+    return true;
 }
 
 void QMakeParser::putTok(ushort *&tokPtr, ushort tok)
@@ -240,7 +386,9 @@ void QMakeParser::putHashStr(ushort *&pTokPtr, const ushort *buf, uint len)
     *tokPtr++ = (ushort)(hash >> 16);
     *tokPtr++ = (ushort)len;
     memcpy(tokPtr, buf, len * 2);
-    pTokPtr = tokPtr + len;
+    tokPtr += len;
+    *tokPtr++ = 0; // Atom, assigned by the evaluator
+    pTokPtr = tokPtr;
 }
 
 void QMakeParser::finalizeHashStr(ushort *buf, uint len)
@@ -252,6 +400,136 @@ void QMakeParser::finalizeHashStr(ushort *buf, uint len)
     buf[-2] = (ushort)(hash >> 16);
 }
 
+///////////////////////////////////////////////////////////////////////
+//
+// Vectorized scanning
+//
+///////////////////////////////////////////////////////////////////////
+
+// The tokenizer looks at every character of a line. Most of them are either
+// copied verbatim into a literal or, in comments, discarded. The functions
+// below skip such runs a vector at a time. They only advance while a full
+// vector fits before the given end and stop at the first character the
+// caller has to look at, so the scalar loops always finish the job.
+
+static bool vectorScanning = true;
+
+void QMakeParser::setVectorScanning(bool enable)
+{
+    vectorScanning = enable;
+}
+
+#ifdef QMAKEPARSER_SSE2
+
+struct Sse2Ops
+{
+    typedef __m128i Vec;
+    enum { Size = 8 };
+    static Vec load(const ushort *p) { return _mm_loadu_si128((const __m128i *)p); }
+    static Vec set(ushort c) { return _mm_set1_epi16(short(c)); }
+    static Vec eq(Vec a, Vec b) { return _mm_cmpeq_epi16(a, b); }
+    static Vec lt(Vec a, Vec b) { return _mm_cmplt_epi16(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm_sub_epi16(a, b); }
+    static Vec or_(Vec a, Vec b) { return _mm_or_si128(a, b); }
+    static Vec xor_(Vec a, Vec b) { return _mm_xor_si128(a, b); }
+    static uint mask(Vec v) { return uint(_mm_movemask_epi8(v)); }
+};
+
+#ifdef QMAKEPARSER_AVX2
+struct Avx2Ops
+{
+    typedef __m256i Vec;
+    enum { Size = 16 };
+    static Vec load(const ushort *p) { return _mm256_loadu_si256((const __m256i *)p); }
+    static Vec set(ushort c) { return _mm256_set1_epi16(short(c)); }
+    static Vec eq(Vec a, Vec b) { return _mm256_cmpeq_epi16(a, b); }
+    static Vec lt(Vec a, Vec b) { return _mm256_cmpgt_epi16(b, a); }
+    static Vec sub(Vec a, Vec b) { return _mm256_sub_epi16(a, b); }
+    static Vec or_(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+    static Vec xor_(Vec a, Vec b) { return _mm256_xor_si256(a, b); }
+    static uint mask(Vec v) { return uint(_mm256_movemask_epi8(v)); }
+};
+#endif
+
+// Unsigned v < c; there are only signed 16 bit comparisons.
+template <typename V>
+static inline typename V::Vec lessThan(typename V::Vec v, ushort c)
+{
+    const typename V::Vec bias = V::set(0x8000);
+    return V::lt(V::xor_(v, bias), V::set(c ^ 0x8000));
+}
+
+// End of line, end of input or start of a comment.
+template <typename V>
+struct LineStops
+{
+    static typename V::Vec match(typename V::Vec v)
+    {
+        return V::or_(V::or_(V::eq(v, V::set('\n')), V::eq(v, V::set('#'))),
+                      V::eq(v, V::set(0)));
+    }
+};
+
+// End of a comment's body.
+template <typename V>
+struct CommentStops
+{
+    static typename V::Vec match(typename V::Vec v)
+    {
+        return V::or_(V::eq(v, V::set('\n')), V::eq(v, V::set(0)));
+    }
+};
+
+// Everything which has a meaning in any of the contexts: whitespace, quotes,
+// '$', '\\', braces, parentheses, separators and operators. Being a superset,
+// this also stops at a few characters which are plain in the current context
+// ('.' and '/' are not, so paths are copied in one go).
+template <typename V>
+struct PlainStops
+{
+    static typename V::Vec match(typename V::Vec v)
+    {
+        typedef typename V::Vec Vec;
+        const Vec punct = lessThan<V>(v, '.'); // Controls, ' ' to '-'
+        const Vec braces = lessThan<V>(V::sub(v, V::set('{')), 4); // '{', '|', '}', '~'
+        const Vec others = V::or_(V::or_(V::eq(v, V::set(':')), V::eq(v, V::set('='))),
+                                  V::eq(v, V::set('\\')));
+        return V::or_(V::or_(punct, braces), others);
+    }
+};
+
+template <template <typename> class Stops, typename V>
+static inline const ushort *skipVectors(const ushort *p, const ushort *end)
+{
+    for (; end - p >= V::Size; p += V::Size) {
+        if (uint mask = V::mask(Stops<V>::match(V::load(p))))
+            return p + qCountTrailingZeroBits(mask) / 2;
+    }
+    return p;
+}
+
+#endif // QMAKEPARSER_SSE2
+
+// Returns the first character in [p, end) matched by Stops, or a position
+// less than a vector before end.
+template <template <typename> class Stops>
+static inline const ushort *skipChars(const ushort *p, const ushort *end)
+{
+    if (!vectorScanning)
+        return p;
+#ifdef QMAKEPARSER_AVX2
+    p = skipVectors<Stops, Avx2Ops>(p, end);
+    if (end - p >= Avx2Ops::Size)
+        return p; // Found a stop
+#endif
+#ifdef QMAKEPARSER_SSE2
+    p = skipVectors<Stops, Sse2Ops>(p, end);
+#else
+    Q_UNUSED(end);
+#endif
+    return p;
+}
+
 bool QMakeParser::read(ProFile *pro, const QString &in, int line, SubGrammar grammar)
 {
     m_proFile = pro;
@@ -262,26 +540,27 @@ bool QMakeParser::read(ProFile *pro, const QString &in, int line, SubGrammar gra
     // Worst-case size calculations:
     // - line marker adds 1 (2-nl) to 1st token of each line
     // - empty assignment "A=":2 =>
-    //   TokHashLiteral(1) + hash(2) + len(1) + "A"(1) + TokAssign(1) +
-    //   TokValueTerminator(1) == 7 (8)
+    //   TokHashLiteral(1) + hash(2) + len(1) + "A"(1) + atom(1) + TokAssign(1) +
+    //   TokValueTerminator(1) == 8 (9)
     // - non-empty assignment "A=B C":5 =>
-    //   TokHashLiteral(1) + hash(2) + len(1) + "A"(1) + TokAssign(1) +
+    //   TokHashLiteral(1) + hash(2) + len(1) + "A"(1) + atom(1) + TokAssign(1) +
     //   TokLiteral(1) + len(1) + "B"(1) +
-    //   TokLiteral(1) + len(1) + "C"(1) + TokValueTerminator(1) == 13 (14)
+    //   TokLiteral(1) + len(1) + "C"(1) + TokValueTerminator(1) == 14 (15)
     // - variable expansion: "$$f":3 =>
-    //   TokVariable(1) + hash(2) + len(1) + "f"(1) = 5
+    //   TokVariable(1) + hash(2) + len(1) + "f"(1) + atom(1) = 6
     // - function expansion: "$$f()":5 =>
-    //   TokFuncName(1) + hash(2) + len(1) + "f"(1) + TokFuncTerminator(1) = 6
+    //   TokFuncName(1) + hash(2) + len(1) + "f"(1) + atom(1) + TokFuncTerminator(1) = 7
     // - scope: "X:":2 =>
-    //   TokHashLiteral(1) + hash(2) + len(1) + "A"(1) + TokCondition(1) +
-    //   TokBranch(1) + len(2) + ... + len(2) + ... == 10
-    // - test: "X():":4 =>
-    //   TokHashLiteral(1) + hash(2) + len(1) + "A"(1) + TokTestCall(1) + TokFuncTerminator(1) +
+    //   TokHashLiteral(1) + hash(2) + len(1) + "A"(1) + atom(1) + TokCondition(1) +
     //   TokBranch(1) + len(2) + ... + len(2) + ... == 11
+    //   (a scope cannot be empty, so the line is at least "X:A=":4 => 19 (20))
+    // - test: "X():":4 =>
+    //   TokHashLiteral(1) + hash(2) + len(1) + "A"(1) + atom(1) + TokTestCall(1) +
+    //   TokFuncTerminator(1) + TokBranch(1) + len(2) + ... + len(2) + ... == 12
     // - "for(A,B):":9 =>
-    //   TokForLoop(1) + hash(2) + len(1) + "A"(1) +
+    //   TokForLoop(1) + hash(2) + len(1) + "A"(1) + atom(1) +
     //   len(2) + TokLiteral(1) + len(1) + "B"(1) + TokValueTerminator(1) +
-    //   len(2) + ... + TokTerminator(1) == 14 (15)
+    //   len(2) + ... + TokTerminator(1) == 15 (16)
     tokBuff.reserve((in.size() + 1) * 5);
     ushort *tokPtr = (ushort *)tokBuff.constData(); // Current writing position
 
@@ -297,8 +576,10 @@ bool QMakeParser::read(ProFile *pro, const QString &in, int line, SubGrammar gra
     QStack<ParseCtx> xprStack;
     xprStack.reserve(10);
 
-    // We rely on QStrings being null-terminated, so don't maintain a global end pointer.
+    // We rely on QStrings being null-terminated. The global end pointer only
+    // bounds the vectorized scans.
     const ushort *cur = (const ushort *)in.unicode();
+    const ushort *inEnd = cur + in.length();
     m_canElse = false;
   freshLine:
     m_state = StNew;
@@ -330,6 +611,7 @@ bool QMakeParser::read(ProFile *pro, const QString &in, int line, SubGrammar gra
     do { \
         if ((tlen = ptr - xprPtr)) { \
             finalizeHashStr(xprPtr, tlen); \
+            *ptr++ = 0; \
             if (needSep) { \
                 wordCount++; \
                 needSep = 0; \
@@ -406,10 +688,11 @@ bool QMakeParser::read(ProFile *pro, const QString &in, int line, SubGrammar gra
         }
 
         // Then strip comments. Yep - no escaping is possible.
-        for (cptr = cur;; ++cptr) {
+        for (cptr = skipChars<LineStops>(cur, inEnd);; ++cptr) {
             c = *cptr;
             if (c == '#') {
-                for (end = cptr; (c = *++cptr);) {
+                end = cptr;
+                for (cptr = skipChars<CommentStops>(cptr + 1, inEnd); (c = *cptr); ++cptr) {
                     if (c == '\n') {
                         ++cptr;
                         break;
@@ -522,6 +805,7 @@ bool QMakeParser::read(ProFile *pro, const QString &in, int line, SubGrammar gra
                                 xprPtr[-3] = (ushort)hash;
                                 xprPtr[-2] = (ushort)(hash >> 16);
                                 xprPtr[-1] = tlen;
+                                *ptr++ = 0; // Atom
                             } else {
                                 xprPtr[-2] = tok;
                                 xprPtr[-1] = tlen;
@@ -752,6 +1036,13 @@ bool QMakeParser::read(ProFile *pro, const QString &in, int line, SubGrammar gra
                     }
                 }
                 *ptr++ = c;
+                {
+                    // Copy the rest of a run of plain characters in one go
+                    const ushort *run = cur;
+                    cur = skipChars<PlainStops>(cur, end);
+                    memcpy(ptr, run, (cur - run) * 2);
+                    ptr += cur - run;
+                }
               nextChr:
                 if (cur == end)
                     goto lineEnd;
@@ -937,7 +1228,7 @@ void QMakeParser::finalizeCond(ushort *&tokPtr, ushort *uc, ushort *ptr, int wor
     // Check for magic tokens
     if (*uc == TokHashLiteral) {
         uint nlen = uc[3];
-        ushort *uce = uc + 4 + nlen;
+        ushort *uce = uc + 5 + nlen;
         if (uce == ptr) {
             m_tmp.setRawData((QChar *)uc + 4, nlen);
             if (!m_tmp.compare(statics.strelse, Qt::CaseInsensitive)) {
@@ -982,7 +1273,7 @@ void QMakeParser::finalizeCall(ushort *&tokPtr, ushort *uc, ushort *ptr, int arg
     // Check for magic tokens
     if (*uc == TokHashLiteral) {
         uint nlen = uc[3];
-        ushort *uce = uc + 4 + nlen;
+        ushort *uce = uc + 5 + nlen;
         if (*uce == TokTestCall) {
             uce++;
             m_tmp.setRawData((QChar *)uc + 4, nlen);
@@ -1005,7 +1296,7 @@ void QMakeParser::finalizeCall(ushort *&tokPtr, ushort *uc, ushort *ptr, int arg
                         // for(literal) (only "ever" would be legal if qmake was sane)
                         putTok(tokPtr, TokForLoop);
                         putHashStr(tokPtr, (ushort *)0, (uint)0);
-                        putBlockLen(tokPtr, 1 + 3 + nlen + 1);
+                        putBlockLen(tokPtr, 1 + 4 + nlen + 1);
                         putTok(tokPtr, TokHashLiteral);
                         putHashStr(tokPtr, uce + 2, nlen);
                       didFor:
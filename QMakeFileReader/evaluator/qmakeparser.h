@@ -49,6 +49,9 @@ class QMAKE_EXPORT QMakeParser
 public:
     // Call this from a concurrency-free context
     static void initialize();
+    // Selects the vectorized scanning of the tokenizer where the build supports it (default),
+    // or the plain per-character loops. For benchmarks; call from a concurrency-free context.
+    static void setVectorScanning(bool enable);
 
     QMakeParser(ProFileCache *cache, QMakeParserHandler *handler);
 
@@ -155,7 +158,16 @@ public:
     void discardFile(const QString &fileName);
     void discardFiles(const QString &prefix);
 
+    // Persist token streams of parsed files in dir, so that other processes can skip parsing
+    // unchanged files. An empty dir disables the on-disk cache.
+    void setDiskCacheDirectory(const QString &dir) { disk_cache_dir = dir; }
+    QString diskCacheDirectory() const { return disk_cache_dir; }
+
 private:
+    QString diskCacheFileName(const QString &fileName) const;
+    bool loadFromDisk(ProFile *pro, const QByteArray &content, qint64 mtime) const;
+    void saveToDisk(const ProFile *pro, const QByteArray &content, qint64 mtime) const;
+
     struct Entry {
         ProFile *pro;
 #ifdef PROPARSER_THREAD_SAFE
@@ -170,6 +182,7 @@ private:
     };
 
     QHash<QString, Entry> parsed_files;
+    QString disk_cache_dir;
 #ifdef PROPARSER_THREAD_SAFE
     QMutex mutex;
 #endif
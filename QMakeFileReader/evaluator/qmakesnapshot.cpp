@@ -0,0 +1,241 @@
+/***************************************************************************************************
+ Copyright (C) 2024 The Qt Company Ltd.
+ SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only WITH Qt-GPL-exception-1.0
+***************************************************************************************************/
+
+#include "qmakeevaluator.h"
+
+#include "qmakeevaluator_p.h"
+#include "qmakeglobals.h"
+#include "qmakeparser.h"
+#include "ioutils.h"
+#include "qmakecachefile.h"
+
+#include <qdatastream.h>
+#include <qdatetime.h>
+#include <qfile.h>
+#include <qfileinfo.h>
+#include <qsavefile.h>
+#include <qset.h>
+
+using namespace QMakeInternal;
+
+QT_BEGIN_NAMESPACE
+
+///////////////////////////////////////////////////////////////////////
+//
+// Snapshots of the evaluated mkspec baseline (see QMakeBaseEnv)
+//
+///////////////////////////////////////////////////////////////////////
+
+enum { SnapshotMagic = 0x51424553, SnapshotVersion = 3 }; // "QBES"
+
+// Everything the baseline depends on besides the contents of the files it loads.
+QString QMakeEvaluator::snapshotKey() const
+{
+    QStringList key;
+    key << QString::number(SnapshotVersion)
+        << m_option->propertyValue(ProKey("QT_HOST_DATA/get")).toQString()
+        << m_option->expandEnvVars(m_hostBuild ? m_option->qmakespec : m_option->xqmakespec)
+        << QString::number(m_hostBuild)
+        << m_superfile << m_conffile << m_cachefile << m_sourceRoot << m_buildRoot
+        << m_option->getEnv(QLatin1String("QMAKEPATH"))
+        << m_option->getEnv(QLatin1String("QMAKEFEATURES"))
+        << m_option->dir_sep;
+    return key.join(QLatin1Char('\n'));
+}
+
+QString QMakeEvaluator::snapshotFileName() const
+{
+    if (m_option->snapshot_dir.isEmpty())
+        return QString();
+    return cacheFileName(m_option->snapshot_dir, snapshotKey(), ".qbes");
+}
+
+static void writeValueMap(QDataStream &stream, const ProValueMap &map)
+{
+    stream << quint32(map.size());
+    for (ProValueMap::ConstIterator it = map.constBegin(); it != map.constEnd(); ++it)
+        stream << it.key().toQString() << it.value().toQStringList();
+}
+
+static bool writeFunctionDefs(QDataStream &stream, const QHash<ProKey, ProFunctionDef> &defs,
+                              const QSet<QString> &files)
+{
+    stream << quint32(defs.size());
+    for (QHash<ProKey, ProFunctionDef>::ConstIterator it = defs.constBegin();
+         it != defs.constEnd(); ++it) {
+        const ProFile *pro = it.value().pro();
+        // Functions from eval() and the like cannot be restored from a file.
+        if (!files.contains(pro->fileName()))
+            return false;
+        stream << it.key().toQString() << pro->fileName()
+               << quint32(it.value().tokPtr() - pro->tokPtr());
+    }
+    return true;
+}
+
+// What is compared for a dependency of the baseline (see QMakeHandler::DependencyType): the
+// size and time of files, the existence of probed paths, the time of listed directories, which
+// changes when entries are added or removed, and the value of environment variables.
+QString QMakeEvaluator::dependencyStamp(int type, const QString &path) const
+{
+    if (type == QMakeHandler::DependEnvironment)
+        return QLatin1Char('=') + m_option->getEnv(path);
+    const QFileInfo fi(path);
+    if (!fi.exists())
+        return QString();
+    switch (type) {
+    case QMakeHandler::DependFileContents:
+        return QString::number(fi.size()) + QLatin1Char(':')
+                + QString::number(fi.lastModified().toMSecsSinceEpoch());
+    case QMakeHandler::DependDirectoryContents:
+        return QString::number(fi.lastModified().toMSecsSinceEpoch());
+    default:
+        return QLatin1String("exists");
+    }
+}
+
+// The stamps of all files and dependencies of baseEnv, to tell whether it is still current.
+QStringList QMakeEvaluator::baseEnvStamps(const QMakeBaseEnv &baseEnv) const
+{
+    QStringList stamps;
+    foreach (const QString &file, baseEnv.files)
+        stamps << dependencyStamp(QMakeHandler::DependFileContents, file);
+    for (int i = 0; i < baseEnv.dependencies.size(); ++i) {
+        const QPair<int, QString> &dependency = baseEnv.dependencies.at(i);
+        stamps << dependencyStamp(dependency.first, dependency.second);
+    }
+    return stamps;
+}
+
+bool QMakeEvaluator::saveSnapshot(const QString &fileName, const QMakeBaseEnv &baseEnv) const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    writeCacheHeader(stream, SnapshotMagic, SnapshotVersion, snapshotKey());
+
+    QSet<QPair<int, QString> > dependencies;
+    foreach (const QString &file, baseEnv.files)
+        dependencies.insert(qMakePair(int(QMakeHandler::DependFileContents), file));
+    for (int i = 0; i < baseEnv.dependencies.size(); ++i) {
+        // Inputs which cannot be checked later make the baseline unfit for reuse.
+        if (baseEnv.dependencies.at(i).first == QMakeHandler::DependVolatile)
+            return false;
+        dependencies.insert(baseEnv.dependencies.at(i));
+    }
+    stream << quint32(dependencies.size());
+    foreach (const QPair<int, QString> &dependency, dependencies) {
+        stream << qint32(dependency.first) << dependency.second
+               << dependencyStamp(dependency.first, dependency.second);
+    }
+
+    const QSet<QString> fileSet = baseEnv.files.toSet();
+
+    stream << m_qmakespec << m_qmakespecName << m_mkspecPaths << m_featureRoots
+           << m_dirSep.toQString();
+    Q_ASSERT(m_valuemapStack.size() == 1);
+    writeValueMap(stream, m_valuemapStack.top());
+    if (!writeFunctionDefs(stream, m_functionDefs.testFunctions, fileSet)
+            || !writeFunctionDefs(stream, m_functionDefs.replaceFunctions, fileSet)) {
+        return false;
+    }
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(data);
+    return file.commit();
+}
+
+static bool readValueMap(QDataStream &stream, ProValueMap *map)
+{
+    quint32 count;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString key;
+        QStringList values;
+        stream >> key >> values;
+        map->insert(ProKey(key), ProStringList(values));
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+bool QMakeEvaluator::readFunctionDefs(QDataStream &stream,
+                                      QHash<ProKey, ProFunctionDef> *defs)
+{
+    quint32 count;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString name, file;
+        quint32 offset;
+        stream >> name >> file >> offset;
+        ProFile *pro = m_parser->parsedProFile(file, true);
+        if (!pro)
+            return false;
+        if (offset >= uint(pro->items().size())) {
+            pro->deref();
+            return false;
+        }
+        defs->insert(ProKey(name), ProFunctionDef(pro, offset));
+        pro->deref();
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+bool QMakeEvaluator::restoreSnapshot(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream stream(&file);
+    if (!readCacheHeader(stream, SnapshotMagic, SnapshotVersion, snapshotKey()))
+        return false;
+
+    // The snapshot is stale as soon as any of the files it was built from changed, or anything
+    // else it depends on. For example, a feature file may have been added to a root which
+    // comes before the one of the file found.
+    QStringList files;
+    QVector<QPair<int, QString> > dependencies;
+    quint32 count;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        qint32 type;
+        QString path, stamp;
+        stream >> type >> path >> stamp;
+        if (stamp != dependencyStamp(type, path))
+            return false;
+        if (type == QMakeHandler::DependFileContents)
+            files << path;
+        else
+            dependencies << qMakePair(int(type), path);
+    }
+
+    QString qmakespec, qmakespecName, dirSep;
+    QStringList mkspecPaths, featureRoots;
+    stream >> qmakespec >> qmakespecName >> mkspecPaths >> featureRoots >> dirSep;
+    ProValueMap values;
+    ProFunctionDefs functionDefs;
+    if (!readValueMap(stream, &values)
+            || !readFunctionDefs(stream, &functionDefs.testFunctions)
+            || !readFunctionDefs(stream, &functionDefs.replaceFunctions)) {
+        return false;
+    }
+
+    m_qmakespec = qmakespec;
+    m_qmakespecName = qmakespecName;
+    m_mkspecPaths = mkspecPaths;
+    m_featureRoots = featureRoots;
+    m_dirSep = ProString(dirSep);
+    m_valuemapStack.top() = values;
+    m_functionDefs = functionDefs;
+    m_valuemapInited = true;
+
+    if (m_baseEnv) {
+        m_baseEnv->files += files;
+        m_baseEnv->dependencies += dependencies;
+    }
+    return true;
+}
+
+QT_END_NAMESPACE
@@ -4,61 +4,215 @@
 ***************************************************************************************************/
 
 #include "qmakedataprovider.h"
+#include "evalprofiler.h"
+#include "resultwriter.h"
 #include <QCoreApplication>
 #include <QStringList>
 #include <QFileInfo>
-#include <QXmlStreamWriter>
+#include <QScopedPointer>
+#include <QTextStream>
 
-QString toString(bool b)
+#ifdef Q_OS_WIN
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+/*
+ * Recursive mode: readTree() follows SUBDIRS of subdirs projects, evaluating the sub-projects
+ * concurrently, and one result is written per leaf project.
+ */
+void writeLeafProjects(ResultWriter *writer, const QMakeDataProvider &dataProvider)
 {
-    return b ? QStringLiteral("true") : QStringLiteral("false");
+    foreach (const QMakeProjectData &data, dataProvider.leafProjects())
+        writer->write(data);
+}
+
+/*
+ * Batch mode: reads one project file path per line from stdin and writes one result per
+ * request, flushing after each one so that a caller can pipe requests into a long-running
+ * process. Parsed files and qmake's global state are kept warm between requests. An empty line
+ * or end of input terminates the session.
+ */
+int runBatch(QMakeDataProvider &dataProvider, ResultWriter::Format format, bool recursive)
+{
+    QFile fin;
+    QFile fout;
+    if (!fin.open(stdin, QFile::ReadOnly) || !fout.open(stdout, QFile::WriteOnly))
+        return 2;
+
+    QTextStream input(&fin);
+    QScopedPointer<ResultWriter> writer(ResultWriter::create(format, &fout));
+    writer->begin(true);
+    fout.flush();
+
+    forever {
+        const QString line = input.readLine().trimmed();
+        if (line.isEmpty())
+            break;
+        const QString filePath = QFileInfo(line).absoluteFilePath();
+        if (recursive) {
+            dataProvider.readTree(filePath);
+            writeLeafProjects(writer.data(), dataProvider);
+        } else {
+            dataProvider.readFile(filePath);
+            writer->write(dataProvider.projectData());
+        }
+        fout.flush();
+    }
+
+    writer->end();
+    return 0;
+}
+
+/*
+ * Profiling: writes the collapsed stacks of all evaluations to fileName and a summary per file
+ * and builtin function to stderr.
+ */
+int writeProfile(const QMakeDataProvider &dataProvider, const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::WriteOnly | QFile::Text)) {
+        fprintf(stderr, "qmakefilereader: cannot write %s\n", qPrintable(fileName));
+        return 2;
+    }
+    QTextStream stacks(&file);
+    dataProvider.profiler()->writeCollapsedStacks(stacks);
+
+    QFile ferr;
+    if (ferr.open(stderr, QFile::WriteOnly)) {
+        QTextStream summary(&ferr);
+        dataProvider.profiler()->writeSummary(summary);
+    }
+    return 0;
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc < 3) {
-        fputs("Usage: qmakefilereader <QtDir> <filePath>\n", stderr);
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    args.removeFirst();
+
+    bool batch = false;
+    bool recursive = false;
+    int jobs = 0;
+    QString cacheDir;
+    QString spec;
+    bool full = false;
+    bool demand = false;
+    bool query = false;
+    bool requery = false;
+    int commandTtl = 0;
+    bool prefetch = false;
+    QStringList variables;
+    bool provenance = false;
+    QString profile;
+    ResultWriter::Format format = ResultWriter::Xml;
+    while (!args.isEmpty() && args.first().startsWith(QLatin1String("--"))) {
+        const QString option = args.takeFirst();
+        if (option == QLatin1String("--batch")) {
+            batch = true;
+        } else if (option == QLatin1String("--recursive")) {
+            recursive = true;
+        } else if (option.startsWith(QLatin1String("--jobs="))) {
+            jobs = option.mid(7).toInt();
+        } else if (option.startsWith(QLatin1String("--cache-dir="))) {
+            cacheDir = QFileInfo(option.mid(12)).absoluteFilePath();
+        } else if (option == QLatin1String("--full")) {
+            full = true;
+        } else if (option == QLatin1String("--demand")) {
+            demand = true;
+        } else if (option == QLatin1String("--query")) {
+            query = true;
+        } else if (option == QLatin1String("--requery")) {
+            query = requery = true;
+        } else if (option.startsWith(QLatin1String("--command-ttl="))) {
+            commandTtl = option.mid(14).toInt();
+        } else if (option == QLatin1String("--prefetch")) {
+            prefetch = true;
+        } else if (option.startsWith(QLatin1String("--spec="))) {
+            spec = option.mid(7);
+        } else if (option.startsWith(QLatin1String("--vars="))) {
+            variables = option.mid(7).split(QLatin1Char(','), QString::SkipEmptyParts);
+        } else if (option == QLatin1String("--provenance")) {
+            provenance = true;
+        } else if (option.startsWith(QLatin1String("--profile="))) {
+            profile = option.mid(10);
+        } else if (option == QLatin1String("--format=binary")) {
+            format = ResultWriter::Binary;
+        } else if (option == QLatin1String("--format=xml")) {
+            format = ResultWriter::Xml;
+        } else {
+            fprintf(stderr, "qmakefilereader: unknown option %s\n", qPrintable(option));
+            return -1;
+        }
+    }
+
+    if (args.size() < (batch ? 1 : 2)) {
+        fputs("Usage: qmakefilereader [options] <QtDir> <filePath>\n"
+              "       qmakefilereader --batch [options] <QtDir>\n"
+              "Options:\n"
+              "  --recursive        Follow SUBDIRS and report each leaf project\n"
+              "  --jobs=<n>         Evaluate at most n sub-projects concurrently\n"
+              "  --cache-dir=<dir>  Keep parsed files, snapshots and results in dir across runs\n"
+              "  --full             Evaluate the mkspec and features like qmake does\n"
+              "  --spec=<spec>      The mkspec to use with --full\n"
+              "  --query            Ask qmake -query for the Qt layout (cached in the cache dir)\n"
+              "  --requery          Like --query, but discard the cached output first\n"
+              "  --command-ttl=<s>  Reuse the output of $$system() in the cache dir for s seconds\n"
+              "  --prefetch         Run the $$system() commands of each file concurrently;\n"
+              "                     commands in branches which are not taken run as well\n"
+              "  --demand           Skip statements which cannot affect the reported variables\n"
+              "  --vars=<a,b,...>   Report these variables instead of the default file lists\n"
+              "  --provenance       Report the file each value was assigned in\n"
+              "  --format=<format>  Write results as xml (default) or binary\n"
+              "  --profile=<file>   Write collapsed stacks of the evaluation time to file\n", stderr);
         return -1;
     }
 
-    QCoreApplication app(argc, argv);
-    const QStringList args = app.arguments();
-    const QString qtDir = args.at(1);
-    const QString filePath = QFileInfo(args.at(2)).absoluteFilePath();
+#ifdef Q_OS_WIN
+    // Keep the C runtime from translating line feeds in binary output.
+    if (format == ResultWriter::Binary)
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    const QString qtDir = args.at(0);
 
     QMakeDataProvider dataProvider;
     dataProvider.setQtDir(qtDir);
-    if (!dataProvider.readFile(filePath))
+    dataProvider.setFullEvaluation(full);
+    dataProvider.setDemandDriven(demand);
+    dataProvider.setQueryProperties(query, requery);
+    dataProvider.setCommandCacheTtl(commandTtl);
+    dataProvider.setPrefetchCommands(prefetch);
+    if (!spec.isEmpty())
+        dataProvider.setSpec(spec);
+    if (!variables.isEmpty())
+        dataProvider.setVariables(variables);
+    dataProvider.setRecordSourceFiles(provenance);
+    dataProvider.setProfilingEnabled(!profile.isEmpty());
+    if (jobs > 0)
+        dataProvider.setMaxThreadCount(jobs);
+    if (!cacheDir.isEmpty())
+        dataProvider.setCacheDirectory(cacheDir);
+    if (batch) {
+        const int ret = runBatch(dataProvider, format, recursive);
+        return ret || profile.isEmpty() ? ret : writeProfile(dataProvider, profile);
+    }
+
+    const QString filePath = QFileInfo(args.at(1)).absoluteFilePath();
+    if (recursive ? !dataProvider.readTree(filePath) : !dataProvider.readFile(filePath))
         return 1;
 
     QFile fout;
     if (!fout.open(stdout, QFile::WriteOnly))
         return 2;
 
-    QXmlStreamWriter stream(&fout);
-    stream.setAutoFormatting(true);
-    stream.writeStartDocument();
-    stream.writeStartElement("content");
-    stream.writeAttribute("valid", toString(dataProvider.isValid()));
-    stream.writeAttribute("flat", toString(dataProvider.isFlat()));
-    stream.writeStartElement("SOURCES");
-    foreach (const QString &str, dataProvider.getSourceFiles())
-         stream.writeTextElement("file", str);
-    stream.writeEndElement();
-    stream.writeStartElement("HEADERS");
-    foreach (const QString &str, dataProvider.getHeaderFiles())
-         stream.writeTextElement("file", str);
-    stream.writeEndElement();
-    stream.writeStartElement("RESOURCES");
-    foreach (const QString &str, dataProvider.getResourceFiles())
-         stream.writeTextElement("file", str);
-    stream.writeEndElement();
-    stream.writeStartElement("FORMS");
-    foreach (const QString &str, dataProvider.getFormFiles())
-         stream.writeTextElement("file", str);
-    stream.writeEndElement();
-    stream.writeEndElement();   // content
-    stream.writeEndDocument();
-    return 0;
+    QScopedPointer<ResultWriter> writer(ResultWriter::create(format, &fout));
+    writer->begin(recursive);
+    if (recursive)
+        writeLeafProjects(writer.data(), dataProvider);
+    else
+        writer->write(dataProvider.projectData());
+    writer->end();
+    return profile.isEmpty() ? 0 : writeProfile(dataProvider, profile);
 }
-
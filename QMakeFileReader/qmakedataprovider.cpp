@@ -5,32 +5,118 @@
 
 #include "qmakedataprovider.h"
 #include "evalhandler.h"
+#include "evalprofiler.h"
+#include "resultcache.h"
 #include <qmakeevaluator.h>
 #include <qmakeglobals.h>
+#include <ioutils.h>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
 #include <QtCore/QFileInfo>
+#include <QtCore/QHash>
 #include <QtCore/QList>
-#include <QtCore/QPair>
+#include <QtCore/QMutex>
+#include <QtCore/QRunnable>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QSet>
+#include <QtCore/QThreadPool>
+
+using namespace QMakeInternal;
 
 class QMakeDataProviderPrivate
 {
 public:
-    QStringList m_headerFiles;
-    QStringList m_sourceFiles;
-    QStringList m_resourceFiles;
-    QStringList m_formFiles;
-    typedef QPair<QStringList *, ProKey> Mapping;
-    QList<Mapping> m_variableMappings;
-    bool m_valid;
-    bool m_flat;
+    QMakeProjectData m_data;
+    QList<QMakeProjectData> m_leafProjects;
+    QList<ProKey> m_variables;
+    bool m_recordSourceFiles;
     QString m_qtdir;
+    QString m_cacheDir;
+    bool m_fullEvaluation;
+    bool m_demandDriven;
+    QAtomicInt m_demandFallbacks; // Demand-driven evaluations which had to be repeated
+    bool m_queryProperties;
+    bool m_refreshProperties;
+    bool m_propertiesPending; // The settings changed since the properties were set
+    QString m_propertiesIdentity; // Of the qmake binary the properties came from
+
+    // Kept alive across readFile() calls, so that consecutive requests share parsed files.
+    // The cache is also shared by the worker threads of readTree().
+    QMakeGlobals m_globals;
+    // Shared by all evaluations of one request, and cleared by the next one.
+    FileTypeCache m_fileTypes;
+    ProFileCache m_proFileCache;
+    EvalHandler m_handler;
+    QMakeParser m_parser;
+    ResultCache m_resultCache;
+    QHash<QString, QDateTime> m_fileTimes;
+    QMutex m_fileTimesMutex;
+    QDateTime m_requestTime; // Files are not parsed before this in the current request
+    QThreadPool m_threadPool;
+    QScopedPointer<EvalProfiler> m_profiler;
+    QMutex m_profilerMutex;
+
+    // One node per project visited by readTree(), evaluated by the task which created it. A
+    // project referenced by several subdirs projects is a child of each of them; only the task
+    // evaluating a node touches its children, and the tree is flattened after all tasks are
+    // done.
+    struct TreeNode
+    {
+        TreeNode() : subdirs(false) {}
+
+        QMakeProjectData data;
+        bool subdirs;
+        QList<TreeNode *> children;
+    };
+    QHash<QString, TreeNode *> m_treeNodes;
+    QMutex m_treeNodesMutex;
+
+    class TreeTask : public QRunnable
+    {
+    public:
+        TreeTask(QMakeDataProviderPrivate *d, TreeNode *node) : m_d(d), m_node(node) {}
+
+        void run()
+        {
+            EvalHandler handler;
+            QMakeParser parser(&m_d->m_proFileCache, &handler);
+            QStringList subProjects;
+            m_d->evaluate(&parser, &handler, &m_node->data, &subProjects, &m_node->subdirs);
+            QList<TreeNode *> created;
+            foreach (const QString &subProject, subProjects) {
+                TreeNode *child;
+                if (m_d->treeNode(subProject, &child))
+                    created << child;
+                m_node->children << child;
+            }
+            foreach (TreeNode *child, created)
+                m_d->m_threadPool.start(new TreeTask(m_d, child));
+        }
+
+    private:
+        QMakeDataProviderPrivate *m_d;
+        TreeNode *m_node;
+    };
 
     QMakeDataProviderPrivate()
+        : m_recordSourceFiles(false)
+        , m_fullEvaluation(false)
+        , m_demandDriven(false)
+        , m_queryProperties(false)
+        , m_refreshProperties(false)
+        , m_propertiesPending(false)
+        , m_parser(&m_proFileCache, &m_handler)
     {
-        m_variableMappings
-                << qMakePair(&m_headerFiles, ProKey("HEADERS"))
-                << qMakePair(&m_sourceFiles, ProKey("SOURCES"))
-                << qMakePair(&m_resourceFiles, ProKey("RESOURCES"))
-                << qMakePair(&m_formFiles, ProKey("FORMS"));
+        // Initialize the statics before evaluators get created on worker threads.
+        QMakeEvaluator::initStatics();
+        m_globals.file_type_cache = &m_fileTypes;
+
+        m_variables
+                << ProKey("SOURCES")
+                << ProKey("HEADERS")
+                << ProKey("RESOURCES")
+                << ProKey("FORMS");
     }
 
     bool readFile(const QString &fileName)
@@ -39,35 +125,373 @@ public:
         if (fi.isRelative())
             qWarning("qmakewrapper: expecting an absolute filename.");
 
-        m_headerFiles.clear();
-        m_sourceFiles.clear();
-        m_resourceFiles.clear();
-        m_formFiles.clear();
-        m_valid = false;
-        m_flat = true;
-
-        QMakeGlobals globals;
-        ProFileCache proFileCache;
-        EvalHandler handler;
-        QMakeParser parser(&proFileCache, &handler);
-        QMakeEvaluator evaluator(&globals, &parser, &handler);
-        if (evaluator.evaluateFile(fileName, QMakeHandler::EvalProjectFile,
-                                   QMakeEvaluator::LoadProOnly) != QMakeEvaluator::ReturnTrue)
-        {
-            qWarning("qmakewrapper: failed to parse %s", qPrintable(fileName));
+        applyProperties();
+        m_requestTime = QDateTime::currentDateTime();
+        discardModifiedFiles();
+        m_fileTypes.clear();
+        m_globals.discardFeatureIndexes();
+        m_globals.recheckBaseEnvs();
+        m_globals.discardCommandOutputs();
+        m_leafProjects.clear();
+        m_data = QMakeProjectData();
+        m_data.fileName = fileName;
+        return evaluate(&m_parser, &m_handler, &m_data);
+    }
+
+    bool readTree(const QString &fileName)
+    {
+        QFileInfo fi(fileName);
+        if (fi.isRelative())
+            qWarning("qmakewrapper: expecting an absolute filename.");
+
+        applyProperties();
+        m_requestTime = QDateTime::currentDateTime();
+        discardModifiedFiles();
+        m_fileTypes.clear();
+        m_globals.discardFeatureIndexes();
+        m_globals.recheckBaseEnvs();
+        m_globals.discardCommandOutputs();
+        m_leafProjects.clear();
+
+        TreeNode *root;
+        treeNode(fileName, &root);
+        m_threadPool.start(new TreeTask(this, root));
+        m_threadPool.waitForDone();
+
+        m_data = root->data;
+        QSet<const TreeNode *> collected;
+        collectLeafProjects(root, &collected);
+        qDeleteAll(m_treeNodes);
+        m_treeNodes.clear();
+        return m_data.valid;
+    }
+
+    // Evaluates data->fileName. If subProjects is not null and the file is a subdirs project,
+    // the project files referenced by SUBDIRS are stored there instead of being extracted.
+    // If isSubdirs is not null, it tells whether the file is a subdirs project.
+    bool evaluate(QMakeParser *parser, EvalHandler *handler, QMakeProjectData *data,
+                  QStringList *subProjects = 0, bool *isSubdirs = 0)
+    {
+        data->valid = false;
+        data->flat = true;
+        if (isSubdirs)
+            *isSubdirs = false;
+
+        const QString key = resultKey(data->fileName);
+        if (m_resultCache.load(key, data, subProjects, isSubdirs))
+            return true;
+        const qint64 startTime = QDateTime::currentMSecsSinceEpoch();
+
+        QScopedPointer<QMakeEvaluator> evaluatorPtr;
+        QMakeEvaluator::LoadFlags flags = QMakeEvaluator::LoadProOnly;
+        EvalProfiler profiler;
+        if (m_profiler)
+            handler->setProfiler(&profiler);
+        bool ok;
+        bool demandDriven = m_demandDriven;
+        forever {
+            evaluatorPtr.reset(new QMakeEvaluator(&m_globals, parser, handler));
+            if (m_fullEvaluation) {
+                // Like an in-source qmake run, so .qmake.conf and .qmake.cache are found.
+                evaluatorPtr->setOutputDir(QFileInfo(data->fileName).absolutePath());
+                flags = QMakeEvaluator::LoadAll;
+            }
+            if (demandDriven)
+                evaluatorPtr->setTargetVariables(demandTargets());
+            ok = evaluatorPtr->evaluateFile(data->fileName, QMakeHandler::EvalProjectFile,
+                                            flags) == QMakeEvaluator::ReturnTrue;
+            // The extraction below only reads targets, so the evaluation is known to be
+            // complete unless a skipped variable has been read already. Such a read may also
+            // be what made the evaluation fail, so failure alone is not conclusive.
+            if (!evaluatorPtr->skippedVariablesRead())
+                break;
+            m_demandFallbacks.ref();
+            handler->takeDependencies();
+            demandDriven = false;
+        }
+        QMakeEvaluator &evaluator = *evaluatorPtr;
+        if (m_profiler) {
+            handler->setProfiler(0);
+            QMutexLocker locker(&m_profilerMutex);
+            m_profiler->merge(profiler);
+        }
+        if (!ok) {
+            recordFileTimes(handler->takeDependencies());
+            qWarning("qmakewrapper: failed to parse %s", qPrintable(data->fileName));
             return false;
         }
 
-        m_valid = true;
-        m_flat = evaluator.isActiveConfig(QStringLiteral("flat"));
+        data->valid = true;
+        data->flat = evaluator.isActiveConfig(QStringLiteral("flat"));
+
+        const bool subdirs = evaluator.first(ProKey("TEMPLATE")) == QLatin1String("subdirs");
+        if (isSubdirs)
+            *isSubdirs = subdirs;
+        if (subProjects && subdirs) {
+            *subProjects = resolveSubProjects(evaluator, data->fileName);
+        } else {
+            foreach (const ProKey &name, m_variables)
+                data->variables << extractVariable(evaluator, handler, name);
+        }
+
+        // Only now, as the handler resolves the source files of the extracted values.
+        const EvalDependencies dependencies = handler->takeDependencies();
+        recordFileTimes(dependencies);
+        m_resultCache.save(key, *data, subdirs, subProjects && subdirs ? subProjects : 0,
+                           dependencies, startTime);
+        return true;
+    }
+
+    // The variables a demand-driven evaluation must compute, see QMakeEvaluator::setTargetVariables().
+    ProStringList demandTargets() const
+    {
+        ProStringList targets;
+        foreach (const ProKey &name, m_variables)
+            targets << name;
+        targets << ProString("TEMPLATE") << ProString("SUBDIRS") << ProString("CONFIG")
+                << ProString("*.file") << ProString("*.subdir");
+        return targets;
+    }
 
-        foreach (const Mapping &mapping, m_variableMappings)
-            *mapping.first = evaluator.values(mapping.second).toQStringList();
+    // Everything besides the files an evaluation reads that makes a difference to its result.
+    QString resultKey(const QString &fileName) const
+    {
+        if (m_resultCache.directory().isEmpty())
+            return QString();
+        QStringList key;
+        key << fileName << m_qtdir << m_globals.qmakespec
+            << QString::number(m_fullEvaluation) << QString::number(m_recordSourceFiles)
+            << QString::fromLocal8Bit(qgetenv("QMAKEPATH"))
+            << QString::fromLocal8Bit(qgetenv("QMAKEFEATURES"))
+            << m_propertiesIdentity;
+        foreach (const ProKey &name, m_variables)
+            key << name.toQString();
+        return key.join(QLatin1Char('\n'));
+    }
+
+    QMakeVariableData extractVariable(const QMakeEvaluator &evaluator, const EvalHandler *handler,
+                                      const ProKey &name) const
+    {
+        QMakeVariableData variable;
+        variable.name = name.toQString();
+        const ProStringList values = evaluator.values(name);
+        variable.values = values.toQStringList();
+        if (m_recordSourceFiles) {
+            foreach (const ProString &value, values)
+                variable.sourceFiles << handler->sourceFileName(value.sourceFile());
+        }
+        return variable;
+    }
 
+    // Follows the rules of qmake's subdirs template: an entry may name a project file, a
+    // directory containing a project file of the same name, or carry .file/.subdir members.
+    static QStringList resolveSubProjects(const QMakeEvaluator &evaluator,
+                                          const QString &fileName)
+    {
+        const QString baseDir = QFileInfo(fileName).absolutePath();
+        QStringList subProjects;
+        foreach (const ProString &subdir, evaluator.values(ProKey("SUBDIRS"))) {
+            const QString name = subdir.toQString();
+            QString path;
+            const ProString file = evaluator.first(ProKey(name + QLatin1String(".file")));
+            if (!file.isEmpty()) {
+                path = file.toQString();
+            } else {
+                const ProString dir = evaluator.first(ProKey(name + QLatin1String(".subdir")));
+                path = dir.isEmpty() ? name : dir.toQString();
+            }
+            path = QDir::cleanPath(IoUtils::resolvePath(baseDir, path));
+            if (IoUtils::fileType(path) == IoUtils::FileIsDir)
+                path += QLatin1Char('/') + IoUtils::fileName(path).toString() + QLatin1String(".pro");
+            subProjects << path;
+        }
+        return subProjects;
+    }
+
+    // Returns true if the node of fileName was created by this call.
+    bool treeNode(const QString &fileName, TreeNode **node)
+    {
+        QMutexLocker locker(&m_treeNodesMutex);
+        TreeNode *&entry = m_treeNodes[fileName];
+        if (entry) {
+            *node = entry;
+            return false;
+        }
+        entry = *node = new TreeNode;
+        entry->data.fileName = fileName;
         return true;
     }
+
+    // In pre-order, so that a project referenced by several subdirs projects is reported at
+    // its first position in SUBDIRS order, whichever task evaluated it. A subdirs project is
+    // never a leaf, even if all of its sub-projects were reported already.
+    void collectLeafProjects(const TreeNode *node, QSet<const TreeNode *> *collected)
+    {
+        if (collected->contains(node))
+            return;
+        collected->insert(node);
+        if (!node->subdirs) {
+            m_leafProjects << node->data;
+            return;
+        }
+        foreach (const TreeNode *child, node->children)
+            collectLeafProjects(child, collected);
+    }
+
+    // The layout of an installed Qt, as reported by qmake -query. Distribution packages may
+    // differ; querying gives the actual layout.
+    static QHash<QString, QString> defaultProperties(const QString &qtdir)
+    {
+        static const struct {
+            const char * const name;
+            const char * const dir;
+        } layout[] = {
+            { "QT_INSTALL_PREFIX", "" },
+            { "QT_INSTALL_ARCHDATA", "" },
+            { "QT_INSTALL_DATA", "" },
+            { "QT_INSTALL_DOCS", "/doc" },
+            { "QT_INSTALL_HEADERS", "/include" },
+            { "QT_INSTALL_LIBS", "/lib" },
+#ifdef Q_OS_WIN
+            { "QT_INSTALL_LIBEXECS", "/bin" },
+#else
+            { "QT_INSTALL_LIBEXECS", "/libexec" },
+#endif
+            { "QT_INSTALL_BINS", "/bin" },
+            { "QT_INSTALL_TESTS", "/tests" },
+            { "QT_INSTALL_PLUGINS", "/plugins" },
+            { "QT_INSTALL_IMPORTS", "/imports" },
+            { "QT_INSTALL_QML", "/qml" },
+            { "QT_INSTALL_TRANSLATIONS", "/translations" },
+            { "QT_INSTALL_CONFIGURATION", "" },
+            { "QT_INSTALL_EXAMPLES", "/examples" },
+            { "QT_INSTALL_DEMOS", "/examples" },
+            { "QT_HOST_PREFIX", "" },
+            { "QT_HOST_DATA", "" },
+            { "QT_HOST_BINS", "/bin" },
+            { "QT_HOST_LIBS", "/lib" }
+        };
+        const QString prefix = QDir::fromNativeSeparators(QDir::cleanPath(qtdir));
+        QHash<QString, QString> properties;
+        for (unsigned i = 0; i < sizeof(layout)/sizeof(layout[0]); ++i) {
+            const QString name = QLatin1String(layout[i].name);
+            const QString value = prefix + QLatin1String(layout[i].dir);
+            properties.insert(name, value);
+            properties.insert(name + QLatin1String("/get"), value);
+            if (name.startsWith(QLatin1String("QT_INSTALL_")))
+                properties.insert(name + QLatin1String("/raw"), value);
+        }
+        properties.insert(QLatin1String("QMAKE_VERSION"), QLatin1String("2.01a"));
+        return properties;
+    }
+
+    // Sets the properties of the Qt dir, which the mkspec and the features need. Projects
+    // evaluated on their own see no properties unless querying is enabled. Without querying,
+    // the output cached by an earlier query is used if it matches the binary. This is deferred
+    // to the first request, so that the cache directory is known by then; with a warm cache,
+    // qmake is not run at all.
+    void applyProperties()
+    {
+        if (!m_propertiesPending)
+            return;
+        m_propertiesPending = false;
+        m_propertiesIdentity.clear();
+        if (!m_fullEvaluation && !m_queryProperties)
+            return;
+        m_globals.setProperties(defaultProperties(m_qtdir));
+        QString qmake = QDir::fromNativeSeparators(QDir::cleanPath(m_qtdir))
+                + QLatin1String("/bin/qmake");
+#ifdef Q_OS_WIN
+        qmake += QLatin1String(".exe");
+#endif
+        if (!m_queryProperties) {
+            if (!m_globals.property_cache_dir.isEmpty())
+                m_globals.loadCachedProperties(qmake, &m_propertiesIdentity);
+            return;
+        }
+        if (m_refreshProperties) {
+            m_globals.discardCachedProperties(qmake);
+            m_refreshProperties = false;
+        }
+        if (!m_globals.queryProperties(qmake, &m_propertiesIdentity)) {
+            qWarning("qmakewrapper: %s -query failed, assuming the default layout",
+                     qPrintable(qmake));
+        }
+    }
+
+    void setCacheDirectory(const QString &dir)
+    {
+        m_cacheDir = dir;
+        m_proFileCache.setDiskCacheDirectory(cacheSubDirectory(QLatin1String("tokens")));
+        updateSnapshotDirectory();
+        m_globals.property_cache_dir = cacheSubDirectory(QLatin1String("properties"));
+        m_globals.command_cache_dir = cacheSubDirectory(QLatin1String("commands"));
+        m_resultCache.setDirectory(cacheSubDirectory(QLatin1String("results")));
+    }
+
+    // Values restored from a snapshot do not know the file they were assigned in.
+    void updateSnapshotDirectory()
+    {
+        m_globals.snapshot_dir = m_recordSourceFiles
+                ? QString() : cacheSubDirectory(QLatin1String("snapshots"));
+    }
+
+    QString cacheSubDirectory(const QString &name) const
+    {
+        if (m_cacheDir.isEmpty())
+            return QString();
+        const QString dir = m_cacheDir + QLatin1Char('/') + name;
+        if (!QDir().mkpath(dir)) {
+            qWarning("qmakewrapper: cannot create cache directory %s", qPrintable(dir));
+            return QString();
+        }
+        return dir;
+    }
+
+    // Files may change between two requests of a long-running session; drop the ones that did
+    // from the parser cache, so that they are read again.
+    void discardModifiedFiles()
+    {
+        QHash<QString, QDateTime>::Iterator it = m_fileTimes.begin();
+        while (it != m_fileTimes.end()) {
+            if (QFileInfo(it.key()).lastModified() != it.value()) {
+                m_proFileCache.discardFile(it.key());
+                it = m_fileTimes.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // A file modified since the request started may have been parsed before it was saved, so
+    // its time is not recorded and the next request reads it again.
+    void recordFileTimes(const EvalDependencies &dependencies)
+    {
+        QMutexLocker locker(&m_fileTimesMutex);
+        foreach (const QString &fileName, dependencies.files) {
+            if (m_fileTimes.contains(fileName))
+                continue;
+            const QDateTime time = QFileInfo(fileName).lastModified();
+            m_fileTimes.insert(fileName, time < m_requestTime ? time : QDateTime());
+        }
+    }
 };
 
+const QMakeVariableData *QMakeProjectData::variable(const QString &name) const
+{
+    foreach (const QMakeVariableData &var, variables) {
+        if (var.name == name)
+            return &var;
+    }
+    return 0;
+}
+
+QStringList QMakeProjectData::values(const QString &name) const
+{
+    const QMakeVariableData *var = variable(name);
+    return var ? var->values : QStringList();
+}
+
 QMakeDataProvider::QMakeDataProvider()
     : d(new QMakeDataProviderPrivate())
 {
@@ -83,37 +507,139 @@ bool QMakeDataProvider::readFile(const QString &fileName)
     return d->readFile(fileName);
 }
 
+bool QMakeDataProvider::readTree(const QString &fileName)
+{
+    return d->readTree(fileName);
+}
+
 void QMakeDataProvider::setQtDir(const QString &qtdir)
 {
     d->m_qtdir = qtdir;
+    d->m_propertiesPending = !qtdir.isEmpty();
+}
+
+void QMakeDataProvider::setSpec(const QString &spec)
+{
+    d->m_globals.qmakespec = spec;
+    d->m_globals.xqmakespec = spec;
+}
+
+void QMakeDataProvider::setFullEvaluation(bool full)
+{
+    d->m_fullEvaluation = full;
+    d->m_propertiesPending = !d->m_qtdir.isEmpty();
+}
+
+void QMakeDataProvider::setDemandDriven(bool demandDriven)
+{
+    d->m_demandDriven = demandDriven;
+}
+
+void QMakeDataProvider::setQueryProperties(bool query, bool refresh)
+{
+    d->m_queryProperties = query;
+    d->m_refreshProperties = refresh;
+    d->m_propertiesPending = !d->m_qtdir.isEmpty();
+}
+
+void QMakeDataProvider::setCommandCacheTtl(int seconds)
+{
+    d->m_globals.command_cache_ttl = seconds;
+}
+
+void QMakeDataProvider::setPrefetchCommands(bool prefetch)
+{
+    d->m_globals.prefetch_commands = prefetch;
+}
+
+void QMakeDataProvider::setMaxThreadCount(int count)
+{
+    d->m_threadPool.setMaxThreadCount(count);
+}
+
+void QMakeDataProvider::setCacheDirectory(const QString &dir)
+{
+    d->setCacheDirectory(dir);
+}
+
+void QMakeDataProvider::setVariables(const QStringList &names)
+{
+    d->m_variables.clear();
+    foreach (const QString &name, names)
+        d->m_variables << ProKey(name);
+}
+
+void QMakeDataProvider::setRecordSourceFiles(bool record)
+{
+    d->m_recordSourceFiles = record;
+    d->updateSnapshotDirectory();
+}
+
+void QMakeDataProvider::setProfilingEnabled(bool enabled)
+{
+    d->m_profiler.reset(enabled ? new EvalProfiler : 0);
+}
+
+const EvalProfiler *QMakeDataProvider::profiler() const
+{
+    // The counters of the evaluator are process-wide, so they are sampled when asked for.
+    if (d->m_profiler) {
+        qint64 hits, misses;
+        QMakeEvaluator::patternCacheStats(&hits, &misses);
+        d->m_profiler->setCounter(QStringLiteral("pattern cache hits"), hits);
+        d->m_profiler->setCounter(QStringLiteral("pattern cache misses"), misses);
+        QMakeEvaluator::expandMemoStats(&hits, &misses);
+        d->m_profiler->setCounter(QStringLiteral("pure function memo hits"), hits);
+        d->m_profiler->setCounter(QStringLiteral("pure function memo misses"), misses);
+        d->m_profiler->setCounter(QStringLiteral("file type cache hits"), d->m_fileTypes.hits());
+        d->m_profiler->setCounter(QStringLiteral("file type cache misses"),
+                                  d->m_fileTypes.misses());
+        d->m_profiler->setCounter(QStringLiteral("demand-driven fallbacks"),
+                                  d->m_demandFallbacks.load());
+        qint64 runs;
+        d->m_globals.commandOutputStats(&hits, &runs);
+        d->m_profiler->setCounter(QStringLiteral("command output hits"), hits);
+        d->m_profiler->setCounter(QStringLiteral("commands run"), runs);
+    }
+    return d->m_profiler.data();
 }
 
 QStringList QMakeDataProvider::getFormFiles() const
 {
-    return d->m_formFiles;
+    return d->m_data.values(QStringLiteral("FORMS"));
 }
 
 QStringList QMakeDataProvider::getHeaderFiles() const
 {
-    return d->m_headerFiles;
+    return d->m_data.values(QStringLiteral("HEADERS"));
 }
 
 QStringList QMakeDataProvider::getResourceFiles() const
 {
-    return d->m_resourceFiles;
+    return d->m_data.values(QStringLiteral("RESOURCES"));
 }
 
 QStringList QMakeDataProvider::getSourceFiles() const
 {
-    return d->m_sourceFiles;
+    return d->m_data.values(QStringLiteral("SOURCES"));
 }
 
 bool QMakeDataProvider::isFlat() const
 {
-    return d->m_flat;
+    return d->m_data.flat;
 }
 
 bool QMakeDataProvider::isValid() const
 {
-    return d->m_valid;
+    return d->m_data.valid;
+}
+
+const QMakeProjectData &QMakeDataProvider::projectData() const
+{
+    return d->m_data;
+}
+
+const QList<QMakeProjectData> &QMakeDataProvider::leafProjects() const
+{
+    return d->m_leafProjects;
 }
@@ -6,11 +6,40 @@
 #ifndef QMAKEDATAPROVIDER_H
 #define QMAKEDATAPROVIDER_H
 
+#include <QtCore/QList>
 #include <QtCore/QString>
 #include <QtCore/QStringList>
 
+class EvalProfiler;
 class QMakeDataProviderPrivate;
 
+/**
+ * The values of one variable. If source files were requested, sourceFiles holds the file each
+ * value was assigned in, or an empty string if that is not known (e.g. for values from eval()).
+ */
+struct QMakeVariableData
+{
+    QString name;
+    QStringList values;
+    QStringList sourceFiles;
+};
+
+/**
+ * The data extracted from one evaluated project file.
+ */
+struct QMakeProjectData
+{
+    QMakeProjectData() : valid(false), flat(true) {}
+
+    const QMakeVariableData *variable(const QString &name) const;
+    QStringList values(const QString &name) const;
+
+    QString fileName;
+    bool valid;
+    bool flat;
+    QList<QMakeVariableData> variables;
+};
+
 class QMakeDataProvider {
 
     QMakeDataProviderPrivate * const d;
@@ -20,14 +49,36 @@ public:
     ~QMakeDataProvider();
 
     bool readFile(const QString &fileName);
+    bool readTree(const QString &fileName);
     void setQtDir(const QString &qtdir);
+    void setSpec(const QString &spec);
+    void setFullEvaluation(bool full);
+    void setDemandDriven(bool demandDriven);
+    // Asks qmake -query instead of assuming the standard layout of the Qt dir. The output is
+    // cached per qmake binary; refresh discards the cached output, e.g. after qmake -set.
+    // Without querying, a cached output is used as long as the binary did not change.
+    void setQueryProperties(bool query, bool refresh = false);
+    // The outputs of $$system() are shared by the evaluations of one request. With a cache
+    // directory and a positive TTL, they are also reused by later runs for that many seconds.
+    void setCommandCacheTtl(int seconds);
+    // Starts the $$system() calls with literal commands of a file concurrently before it is
+    // evaluated. This includes the calls in branches the evaluation does not take, so commands
+    // with side effects may run although the project does not call them.
+    void setPrefetchCommands(bool prefetch);
+    void setMaxThreadCount(int count);
+    void setCacheDirectory(const QString &dir);
+    void setVariables(const QStringList &names);
+    void setRecordSourceFiles(bool record);
+    void setProfilingEnabled(bool enabled);
+    const EvalProfiler *profiler() const;
     QStringList getFormFiles() const;
     QStringList getHeaderFiles() const;
     QStringList getResourceFiles() const;
     QStringList getSourceFiles() const;
     bool isFlat() const;
     bool isValid() const;
+    const QMakeProjectData &projectData() const;
+    const QList<QMakeProjectData> &leafProjects() const;
 };
 
 #endif // QMAKEDATAPROVIDER_H
-
@@ -0,0 +1,171 @@
+/***************************************************************************************************
+ Copyright (C) 2024 The Qt Company Ltd.
+ SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only WITH Qt-GPL-exception-1.0
+***************************************************************************************************/
+
+#include "resultcache.h"
+#include "evalhandler.h"
+#include "qmakedataprovider.h"
+#include <qmakecachefile.h>
+#include <QtCore/QByteArray>
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+
+namespace {
+
+enum { Magic = 0x43524d51, Version = 2 }; // "QMRC"
+enum { Valid = 1, Flat = 2, Subdirs = 4, SubProjectsResolved = 8 };
+enum DependencyKind {
+    FileDependency, ProbeDependency, DirectoryDependency, EnvironmentDependency
+};
+
+QString environmentValue(const QString &name)
+{
+    return QString::fromLocal8Bit(qgetenv(name.toLocal8Bit().constData()));
+}
+
+// What is compared for a dependency: size and time of files, the existence of probed paths
+// and the time of directories, which changes when entries are added or removed.
+void stamp(int kind, const QString &path, qint64 *size, qint64 *mtime)
+{
+    const QFileInfo fi(path);
+    if (!fi.exists()) {
+        *size = -1;
+        *mtime = 0;
+        return;
+    }
+    *size = kind == FileDependency ? fi.size() : 0;
+    *mtime = kind == ProbeDependency ? 0 : fi.lastModified().toMSecsSinceEpoch();
+}
+
+bool writeDependencies(QDataStream &stream, int kind, const QStringList &paths, qint64 startTime)
+{
+    foreach (const QString &path, paths) {
+        qint64 size, mtime;
+        stamp(kind, path, &size, &mtime);
+        // Modified while being evaluated, so the result may not reflect the recorded state.
+        if (mtime >= startTime)
+            return false;
+        stream << quint8(kind) << path << size << mtime;
+    }
+    return true;
+}
+
+} // namespace
+
+QString ResultCache::fileName(const QString &key) const
+{
+    return QMakeInternal::cacheFileName(m_dir, key, ".qres");
+}
+
+bool ResultCache::load(const QString &key, QMakeProjectData *data,
+                       QStringList *subProjects, bool *subdirs) const
+{
+    if (m_dir.isEmpty())
+        return false;
+    QFile file(fileName(key));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream stream(&file);
+    if (!QMakeInternal::readCacheHeader(stream, Magic, Version, key))
+        return false;
+
+    quint32 count;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        quint8 kind;
+        QString path;
+        stream >> kind >> path;
+        if (kind == EnvironmentDependency) {
+            QString value;
+            stream >> value;
+            if (value != environmentValue(path))
+                return false;
+            continue;
+        }
+        qint64 size, mtime;
+        stream >> size >> mtime;
+        qint64 currentSize, currentTime;
+        stamp(kind, path, &currentSize, &currentTime);
+        if (currentSize != size || currentTime != mtime)
+            return false;
+    }
+
+    quint8 flags;
+    QStringList resolved;
+    stream >> flags >> resolved;
+    if (flags & SubProjectsResolved) {
+        if (!subProjects)
+            return false;
+    } else if (subProjects && (flags & Subdirs)) {
+        return false;
+    }
+
+    QMakeProjectData result;
+    result.fileName = data->fileName;
+    result.valid = flags & Valid;
+    result.flat = flags & Flat;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QMakeVariableData variable;
+        stream >> variable.name >> variable.values >> variable.sourceFiles;
+        result.variables << variable;
+    }
+    if (stream.status() != QDataStream::Ok)
+        return false;
+
+    *data = result;
+    if (subProjects)
+        *subProjects = resolved;
+    if (subdirs)
+        *subdirs = flags & Subdirs;
+    return true;
+}
+
+void ResultCache::save(const QString &key, const QMakeProjectData &data, bool subdirs,
+                       const QStringList *subProjects, const EvalDependencies &dependencies,
+                       qint64 startTime) const
+{
+    if (m_dir.isEmpty() || dependencies.isVolatile)
+        return;
+
+    QByteArray entry;
+    QDataStream stream(&entry, QIODevice::WriteOnly);
+    QMakeInternal::writeCacheHeader(stream, Magic, Version, key);
+    stream << quint32(dependencies.files.size() + dependencies.probedPaths.size()
+                      + dependencies.listedDirectories.size()
+                      + dependencies.environment.size());
+    if (!writeDependencies(stream, FileDependency, dependencies.files, startTime)
+            || !writeDependencies(stream, ProbeDependency, dependencies.probedPaths, startTime)
+            || !writeDependencies(stream, DirectoryDependency, dependencies.listedDirectories,
+                                  startTime)) {
+        return;
+    }
+    for (QHash<QString, QString>::ConstIterator it = dependencies.environment.constBegin();
+         it != dependencies.environment.constEnd(); ++it) {
+        // Changed while being evaluated, so the result may not reflect the recorded value.
+        if (environmentValue(it.key()) != it.value())
+            return;
+        stream << quint8(EnvironmentDependency) << it.key() << it.value();
+    }
+
+    int flags = (data.valid ? Valid : 0) | (data.flat ? Flat : 0) | (subdirs ? Subdirs : 0);
+    if (subProjects)
+        flags |= SubProjectsResolved;
+    stream << quint8(flags) << (subProjects ? *subProjects : QStringList());
+    stream << quint32(data.variables.size());
+    foreach (const QMakeVariableData &variable, data.variables)
+        stream << variable.name << variable.values << variable.sourceFiles;
+
+    QSaveFile file(fileName(key));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning("qmakewrapper: cannot write %s", qPrintable(file.fileName()));
+        return;
+    }
+    file.write(entry);
+    if (!file.commit())
+        qWarning("qmakewrapper: cannot write %s", qPrintable(file.fileName()));
+}
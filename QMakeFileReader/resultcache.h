@@ -0,0 +1,45 @@
+/***************************************************************************************************
+ Copyright (C) 2024 The Qt Company Ltd.
+ SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only WITH Qt-GPL-exception-1.0
+***************************************************************************************************/
+
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+struct EvalDependencies;
+struct QMakeProjectData;
+
+/**
+ * Keeps evaluation results on disk together with everything they depend on. A result is
+ * returned as long as none of its files changed, none of its probed paths appeared or
+ * disappeared, none of its listed directories changed and none of the environment variables
+ * it read changed. Volatile results are not kept.
+ *
+ * The key identifies the project and every setting that influences its evaluation. Entries for
+ * subdirs projects carry either the resolved sub-projects or the extracted variables, see
+ * load().
+ */
+class ResultCache
+{
+public:
+    void setDirectory(const QString &dir) { m_dir = dir; }
+    QString directory() const { return m_dir; }
+
+    // If subProjects is not null, a subdirs project needs an entry with resolved sub-projects.
+    // If subdirs is not null, it tells whether the entry is one of a subdirs project.
+    bool load(const QString &key, QMakeProjectData *data, QStringList *subProjects,
+              bool *subdirs) const;
+    void save(const QString &key, const QMakeProjectData &data, bool subdirs,
+              const QStringList *subProjects, const EvalDependencies &dependencies,
+              qint64 startTime) const;
+
+private:
+    QString fileName(const QString &key) const;
+
+    QString m_dir;
+};
+
+#endif // RESULTCACHE_H
@@ -0,0 +1,170 @@
+/***************************************************************************************************
+ Copyright (C) 2024 The Qt Company Ltd.
+ SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only WITH Qt-GPL-exception-1.0
+***************************************************************************************************/
+
+#include "resultwriter.h"
+#include "qmakedataprovider.h"
+#include <QtCore/QByteArray>
+#include <QtCore/QDataStream>
+#include <QtCore/QIODevice>
+#include <QtCore/QXmlStreamWriter>
+
+namespace {
+
+QString toString(bool b)
+{
+    return b ? QStringLiteral("true") : QStringLiteral("false");
+}
+
+class XmlResultWriter : public ResultWriter
+{
+public:
+    XmlResultWriter(QIODevice *device)
+        : m_stream(device)
+        , m_multiple(false)
+    {
+        m_stream.setAutoFormatting(true);
+    }
+
+    void begin(bool multiple)
+    {
+        m_multiple = multiple;
+        m_stream.writeStartDocument();
+        if (m_multiple)
+            m_stream.writeStartElement("results");
+    }
+
+    void write(const QMakeProjectData &data)
+    {
+        m_stream.writeStartElement("content");
+        if (m_multiple)
+            m_stream.writeAttribute("file", data.fileName);
+        m_stream.writeAttribute("valid", toString(data.valid));
+        m_stream.writeAttribute("flat", toString(data.flat));
+        foreach (const QMakeVariableData &variable, data.variables)
+            writeFileList(variable);
+        m_stream.writeEndElement();   // content
+    }
+
+    void end()
+    {
+        if (m_multiple)
+            m_stream.writeEndElement();   // results
+        m_stream.writeEndDocument();
+    }
+
+private:
+    void writeFileList(const QMakeVariableData &variable)
+    {
+        m_stream.writeStartElement(variable.name);
+        const bool hasSources = !variable.sourceFiles.isEmpty();
+        for (int i = 0; i < variable.values.size(); ++i) {
+            m_stream.writeStartElement("file");
+            if (hasSources)
+                m_stream.writeAttribute("source", variable.sourceFiles.at(i));
+            m_stream.writeCharacters(variable.values.at(i));
+            m_stream.writeEndElement();
+        }
+        m_stream.writeEndElement();
+    }
+
+    QXmlStreamWriter m_stream;
+    bool m_multiple;
+};
+
+/*
+ * Binary format, all integers little-endian:
+ *
+ *   header:  "QMFR" version:u32
+ *   record:  size:u32 followed by size bytes of
+ *              flags:u8 (1 = valid, 2 = flat)
+ *              fileName:string
+ *              listCount:u32 followed by listCount lists
+ *   list:    name:string
+ *            flags:u8 (1 = each value is followed by the file it was assigned in)
+ *            count:u32 followed by count values, each a string, or two with sources
+ *   string:  size:u32 followed by size bytes of UTF-8
+ *
+ * Records follow each other until the end of the stream. Readers must skip lists they do not
+ * know and the remainder of a record beyond the data they understand.
+ */
+class BinaryResultWriter : public ResultWriter
+{
+public:
+    enum { Version = 2 };
+    enum { Valid = 1, Flat = 2 };
+    enum { HasSources = 1 };
+
+    BinaryResultWriter(QIODevice *device)
+        : m_device(device)
+    {
+    }
+
+    void begin(bool multiple)
+    {
+        Q_UNUSED(multiple);
+        QByteArray header;
+        QDataStream stream(&header, QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+        stream.writeRawData("QMFR", 4);
+        stream << quint32(Version);
+        m_device->write(header);
+    }
+
+    void write(const QMakeProjectData &data)
+    {
+        QByteArray record;
+        QDataStream stream(&record, QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+        stream << quint32(0); // Size, patched below
+        stream << quint8((data.valid ? Valid : 0) | (data.flat ? Flat : 0));
+        writeString(stream, data.fileName);
+        stream << quint32(data.variables.size());
+        foreach (const QMakeVariableData &variable, data.variables)
+            writeList(stream, variable);
+
+        const quint32 size = record.size() - 4;
+        record[0] = char(size);
+        record[1] = char(size >> 8);
+        record[2] = char(size >> 16);
+        record[3] = char(size >> 24);
+        m_device->write(record);
+    }
+
+    void end()
+    {
+    }
+
+private:
+    static void writeString(QDataStream &stream, const QString &str)
+    {
+        const QByteArray utf8 = str.toUtf8();
+        stream << quint32(utf8.size());
+        stream.writeRawData(utf8.constData(), utf8.size());
+    }
+
+    static void writeList(QDataStream &stream, const QMakeVariableData &variable)
+    {
+        const bool hasSources = !variable.sourceFiles.isEmpty();
+        writeString(stream, variable.name);
+        stream << quint8(hasSources ? HasSources : 0);
+        stream << quint32(variable.values.size());
+        for (int i = 0; i < variable.values.size(); ++i) {
+            writeString(stream, variable.values.at(i));
+            if (hasSources)
+                writeString(stream, variable.sourceFiles.at(i));
+        }
+    }
+
+    QIODevice *m_device;
+};
+
+} // namespace
+
+ResultWriter *ResultWriter::create(Format format, QIODevice *device)
+{
+    if (format == Binary)
+        return new BinaryResultWriter(device);
+    return new XmlResultWriter(device);
+}
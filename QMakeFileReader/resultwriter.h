@@ -0,0 +1,35 @@
+/***************************************************************************************************
+ Copyright (C) 2024 The Qt Company Ltd.
+ SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only WITH Qt-GPL-exception-1.0
+***************************************************************************************************/
+
+#ifndef RESULTWRITER_H
+#define RESULTWRITER_H
+
+#include <QtCore/QString>
+
+QT_BEGIN_NAMESPACE
+class QIODevice;
+QT_END_NAMESPACE
+
+struct QMakeProjectData;
+
+/**
+ * Writes project data to an output device. A session consists of begin(), any number of
+ * write() calls and end(); with multiple set, every result also carries its file name.
+ */
+class ResultWriter
+{
+public:
+    enum Format { Xml, Binary };
+
+    virtual ~ResultWriter() {}
+
+    virtual void begin(bool multiple) = 0;
+    virtual void write(const QMakeProjectData &data) = 0;
+    virtual void end() = 0;
+
+    static ResultWriter *create(Format format, QIODevice *device);
+};
+
+#endif // RESULTWRITER_H
@@ -0,0 +1,70 @@
+/***************************************************************************************************
+ Copyright (C) 2024 The Qt Company Ltd.
+ SPDX-License-Identifier: LicenseRef-Qt-Commercial OR GPL-3.0-only WITH Qt-GPL-exception-1.0
+***************************************************************************************************/
+
+/*
+ * Tests of QMakeDataProvider on small generated projects.
+ *
+ * Build with qmake tst_dataprovider.pro && make check.
+ */
+
+#include "qmakedataprovider.h"
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryDir>
+#include <QtTest/QtTest>
+
+class tst_DataProvider : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void prefetchCommands();
+
+private:
+    static bool writeFile(const QString &fileName, const char *contents);
+};
+
+bool tst_DataProvider::writeFile(const QString &fileName, const char *contents)
+{
+    QFile file(fileName);
+    return file.open(QIODevice::WriteOnly) && file.write(contents) >= 0;
+}
+
+// The commands of a project and of the files it includes are prefetched before these are
+// entered, so the results must not depend on it.
+void tst_DataProvider::prefetchCommands()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString proFile = dir.path() + QLatin1String("/root.pro");
+    QVERIFY(writeFile(proFile,
+                      "include(sub.pri)\n"
+                      "SOURCES += $$system(echo main.cpp)\n"
+                      "for(name, $$list(one two)): SOURCES += $$system(echo $${name}.cpp)\n"
+                      "HEADERS += $$headerOf(main)\n"));
+    QVERIFY(writeFile(dir.path() + QLatin1String("/sub.pri"),
+                      "SOURCES += $$system(echo sub.cpp)\n"
+                      "defineReplace(headerOf) {\n"
+                      "    return($$system(echo $${1}.h))\n"
+                      "}\n"
+                      "HEADERS += $$system(echo sub.h)\n"));
+
+    QMakeDataProvider plain;
+    QVERIFY(plain.readFile(proFile));
+
+    QMakeDataProvider prefetching;
+    prefetching.setPrefetchCommands(true);
+    // The second request evaluates the code lowered by the first one.
+    for (int i = 0; i < 2; ++i) {
+        QVERIFY(prefetching.readFile(proFile));
+        QCOMPARE(prefetching.getSourceFiles(), plain.getSourceFiles());
+        QCOMPARE(prefetching.getHeaderFiles(), plain.getHeaderFiles());
+    }
+    QCOMPARE(plain.getSourceFiles().size(), 4);
+    QCOMPARE(plain.getHeaderFiles().size(), 2);
+}
+
+QTEST_GUILESS_MAIN(tst_DataProvider)
+
+#include "tst_dataprovider.moc"
@@ -0,0 +1,24 @@
+QT = core testlib
+CONFIG += console c++11 testcase
+CONFIG -= app_bundle
+
+TARGET = tst_dataprovider
+
+DEFINES += PROPARSER_THREAD_SAFE PROEVALUATOR_THREAD_SAFE
+
+include(../../evaluator/evaluator.pri)
+
+INCLUDEPATH += ../..
+
+HEADERS += \
+    ../../evalhandler.h \
+    ../../evalprofiler.h \
+    ../../qmakedataprovider.h \
+    ../../resultcache.h
+
+SOURCES += \
+    tst_dataprovider.cpp \
+    ../../evalhandler.cpp \
+    ../../evalprofiler.cpp \
+    ../../qmakedataprovider.cpp \
+    ../../resultcache.cpp
@@ -6,7 +6,7 @@
 using System.Collections.Generic;
 using System.Diagnostics;
 using System.IO;
-using System.Xml;
+using System.Text;
 
 namespace QtVsTools.Core
 {
@@ -42,52 +42,90 @@ namespace QtVsTools.Core
                 if (!File.Exists(exeFilePath))
                     return false;
 
-                string output;
-                using (var process = new Process()) {
-                    process.StartInfo.CreateNoWindow = true;
-                    process.StartInfo.FileName = exeFilePath;
-                    process.StartInfo.Arguments = SafeQuote(QtDir) + ' ' + SafeQuote(filePath);
-                    process.StartInfo.UseShellExecute = false;
-                    process.StartInfo.RedirectStandardOutput = true;
-                    if (!process.Start())
-                        return false;
-                    output = process.StandardOutput.ReadToEnd();
-                    process.WaitForExit();
-                }
+                using var process = new Process();
+                process.StartInfo.CreateNoWindow = true;
+                process.StartInfo.FileName = exeFilePath;
+                process.StartInfo.Arguments = "--format=binary "
+                    + SafeQuote(QtDir) + ' ' + SafeQuote(filePath);
+                process.StartInfo.UseShellExecute = false;
+                process.StartInfo.RedirectStandardOutput = true;
+                if (!process.Start())
+                    return false;
 
-                StringReader stringReader = null;
-                try {
-                    stringReader = new StringReader(output);
-                    using var reader = new XmlTextReader(stringReader);
-                    stringReader = null;
-                    reader.ReadToFollowing("content");
-                    IsFlat = reader.GetAttribute("flat") == "true";
-                    SourceFiles = ReadFileElements(reader, "SOURCES");
-                    HeaderFiles = ReadFileElements(reader, "HEADERS");
-                    ResourceFiles = ReadFileElements(reader, "RESOURCES");
-                    FormFiles = ReadFileElements(reader, "FORMS");
-                } finally {
-                    stringReader?.Dispose();
+                bool result;
+                using (var reader = new BinaryReader(process.StandardOutput.BaseStream)) {
+                    result = ReadHeader(reader) && ReadRecord(reader);
                 }
+                process.WaitForExit();
+                return result;
             } catch {
                 return false;
             }
-            return true;
         }
 
-        private static string[] ReadFileElements(XmlReader reader, string tag)
+        // See BinaryResultWriter in QMakeFileReader/resultwriter.cpp for the format.
+        private const uint BinaryFormatVersion = 2;
+        private const byte FlagFlat = 2;
+        private const byte FlagHasSources = 1;
+
+        private static bool ReadHeader(BinaryReader reader)
         {
-            var fileNames = new List<string>();
-            if (!reader.ReadToFollowing(tag))
-                return fileNames.ToArray();
+            var magic = reader.ReadBytes(4);
+            if (magic.Length != 4 || Encoding.ASCII.GetString(magic) != "QMFR")
+                return false;
+            return reader.ReadUInt32() == BinaryFormatVersion;
+        }
+
+        private bool ReadRecord(BinaryReader stream)
+        {
+            var size = stream.ReadUInt32();
+            var record = stream.ReadBytes((int)size);
+            if (record.Length != size)
+                return false;
 
-            if (!reader.ReadToDescendant("file"))
-                return fileNames.ToArray();
+            using var reader = new BinaryReader(new MemoryStream(record));
+            IsFlat = (reader.ReadByte() & FlagFlat) != 0;
+            ReadString(reader); // file name
+            SourceFiles = HeaderFiles = ResourceFiles = FormFiles = new string[0];
+            var listCount = reader.ReadUInt32();
+            for (uint i = 0; i < listCount; ++i) {
+                var name = ReadString(reader);
+                var files = ReadStringList(reader);
+                switch (name) {
+                case "SOURCES":
+                    SourceFiles = files;
+                    break;
+                case "HEADERS":
+                    HeaderFiles = files;
+                    break;
+                case "RESOURCES":
+                    ResourceFiles = files;
+                    break;
+                case "FORMS":
+                    FormFiles = files;
+                    break;
+                }
+            }
+            return true;
+        }
 
-            do {
-                fileNames.Add(reader.ReadString());
-            } while (reader.ReadToNextSibling("file"));
-            return fileNames.ToArray();
+        private static string ReadString(BinaryReader reader)
+        {
+            var size = reader.ReadUInt32();
+            return Encoding.UTF8.GetString(reader.ReadBytes((int)size));
+        }
+
+        private static string[] ReadStringList(BinaryReader reader)
+        {
+            var hasSources = (reader.ReadByte() & FlagHasSources) != 0;
+            var count = reader.ReadUInt32();
+            var strings = new List<string>((int)count);
+            for (uint i = 0; i < count; ++i) {
+                strings.Add(ReadString(reader));
+                if (hasSources)
+                    ReadString(reader); // source file
+            }
+            return strings.ToArray();
         }
     }
 }